@@ -0,0 +1,195 @@
+/******     ----- thumb cpu core benchmark -----     ******/
+
+//runs a small thumb workload (LCG fill, byte/halfword checksum, bubble sort pass) straight on the cpu core, no SoC around it
+//build with "make thumbBench", run as "./thumbBench [iterations]". the result must not change between cpu core variants
+
+#include "../emulator/CPU/CPU.h"
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAM_SIZE	0x10000UL
+#define CODE_BASE	0x00000000UL
+#define STACK_TOP	0x00008000UL
+#define DEF_ITERS	40000UL
+
+static const UInt16 benchCode[] = {		//r6 = iterations, r0 = result once we hypercall
+
+				//start:
+	0x4F26,			//	ldr r7, =0x1000
+	0x2400,			//	mov r4, #0
+	0x4D26,			//	ldr r5, =0x12345678
+				//main:
+	0xF000,			//	bl fill
+	0xF809,
+	0xF000,			//	bl sum
+	0xF812,
+	0xF000,			//	bl sort
+	0xF836,
+	0x3E01,			//	sub r6, #1
+	0xD1F7,			//	bne main
+	0x1C20,			//	add r0, r4, #0
+	0xBBBB,			//	hypercall
+				//stop:
+	0xE7FE,			//	b stop
+				//fill:
+	0xB510,			//	push {r4, lr}
+	0x1C38,			//	add r0, r7, #0
+	0x2140,			//	mov r1, #64
+	0x4A20,			//	ldr r2, =1103515245
+	0x4B20,			//	ldr r3, =12345
+				//fill_loop:
+	0x4355,			//	mul r5, r2
+	0x18ED,			//	add r5, r5, r3
+	0xC020,			//	stmia r0!, {r5}
+	0x3901,			//	sub r1, #1
+	0xD1FA,			//	bne fill_loop
+	0xBD10,			//	pop {r4, pc}
+				//sum:
+	0xB560,			//	push {r5, r6, lr}
+	0xB082,			//	sub sp, #8
+	0x2000,			//	mov r0, #0
+	0x2307,			//	mov r3, #7
+				//sum_bytes:
+	0x5C39,			//	ldrb r1, [r7, r0]
+	0x563A,			//	ldrsb r2, [r7, r0]
+	0x1864,			//	add r4, r4, r1
+	0x4054,			//	eor r4, r2
+	0x41DC,			//	ror r4, r3
+	0x3001,			//	add r0, #1
+	0x28FF,			//	cmp r0, #255
+	0xD9F7,			//	bls sum_bytes
+	0x1C38,			//	add r0, r7, #0
+	0x2620,			//	mov r6, #32
+				//sum_halves:
+	0x8802,			//	ldrh r2, [r0, #0]
+	0x8843,			//	ldrh r3, [r0, #2]
+	0x00DB,			//	lsl r3, r3, #3
+	0x1AD2,			//	sub r2, r2, r3
+	0x1092,			//	asr r2, r2, #2
+	0x4154,			//	adc r4, r2
+	0x6841,			//	ldr r1, [r0, #4]
+	0x0949,			//	lsr r1, r1, #5
+	0x4391,			//	bic r1, r2
+	0x430C,			//	orr r4, r1
+	0x80C2,			//	strh r2, [r0, #6]
+	0x5584,			//	strb r4, [r0, r6]
+	0x9400,			//	str r4, [sp, #0]
+	0x9D00,			//	ldr r5, [sp, #0]
+	0x43ED,			//	mvn r5, r5
+	0x4225,			//	tst r5, r4
+	0xD001,			//	beq sum_skip
+	0x426D,			//	neg r5, r5
+	0x41AC,			//	sbc r4, r5
+				//sum_skip:
+	0x3008,			//	add r0, #8
+	0x3E01,			//	sub r6, #1
+	0xD1E9,			//	bne sum_halves
+	0xB002,			//	add sp, #8
+	0xBD60,			//	pop {r5, r6, pc}
+				//sort:
+	0x1C38,			//	add r0, r7, #0
+	0x231F,			//	mov r3, #31
+				//sort_loop:
+	0x6801,			//	ldr r1, [r0, #0]
+	0x6842,			//	ldr r2, [r0, #4]
+	0x4291,			//	cmp r1, r2
+	0xD901,			//	bls sort_next
+	0x6002,			//	str r2, [r0, #0]
+	0x6041,			//	str r1, [r0, #4]
+				//sort_next:
+	0x3004,			//	add r0, #4
+	0x3B01,			//	sub r3, #1
+	0xD1F6,			//	bne sort_loop
+	0x46A0,			//	mov r8, r4
+	0x4444,			//	add r4, r8
+	0x4770,			//	bx lr
+	0x46C0,			//	nop (align literal pool)
+	0x1000, 0x0000,		//	.word 0x00001000
+	0x5678, 0x1234,		//	.word 0x12345678
+	0x4E6D, 0x41C6,		//	.word 0x41C64E6D
+	0x3039, 0x0000,		//	.word 0x00003039
+};
+
+static UInt8 ram[RAM_SIZE];
+static Boolean done = false;
+
+//////// runtime things the cpu core wants
+
+void* emu_alloc(UInt32 size){
+
+	return calloc(size,1);
+}
+
+void emu_free(void* ptr){
+
+	free(ptr);
+}
+
+void err_str(const char* str){
+
+	fprintf(stderr, "%s", str);
+}
+
+#include "../emulator/helper/print.h"
+
+static Boolean benchMemF(_UNUSED_ struct ArmCpu* cpu, void* buf, UInt32 vaddr, UInt8 size, Boolean write, _UNUSED_ Boolean priviledged, UInt8* fsr){
+
+	if(vaddr >= RAM_SIZE || RAM_SIZE - vaddr < size){
+		*fsr = 0x0D;	//perm error
+		return false;
+	}
+
+	if(write) memcpy(ram + vaddr, buf, size);
+	else memcpy(buf, ram + vaddr, size);
+
+	return true;
+}
+
+static Boolean benchHypercall(struct ArmCpu* cpu){
+
+	done = true;
+	cpuAttention(cpu);
+	return true;
+}
+
+static void benchEmulErr(_UNUSED_ struct ArmCpu* cpu, const char* str){
+
+	fprintf(stderr, "EMULATION ERROR: %s\n", str);
+	exit(-1);
+}
+
+int main(int argc, char** argv){
+
+	UInt32 i, iters = DEF_ITERS;
+	unsigned long long instrs = 0;
+	struct timeval start, end;
+	double secs;
+	ArmCpu cpu;
+
+	if(argc > 1) iters = strtoul(argv[1], NULL, 0);
+
+	for(i = 0; i < sizeof(benchCode) / sizeof(*benchCode); i++){	//little-endian guest
+
+		ram[CODE_BASE + i * 2 + 0] = benchCode[i];
+		ram[CODE_BASE + i * 2 + 1] = benchCode[i] >> 8;
+	}
+
+	if(cpuInit(&cpu, CODE_BASE | 1, benchMemF, benchEmulErr, benchHypercall, NULL) != errNone){
+		fprintf(stderr, "cannot init cpu\n");
+		return -1;
+	}
+	cpuSetReg(&cpu, 6, iters);
+	cpuSetReg(&cpu, 13, STACK_TOP);
+
+	gettimeofday(&start, NULL);
+	while(!done) instrs += cpuRun(&cpu, 1000);
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("result=%08lX instrs=%llu time=%.3fs speed=%.2f MIPS\n", (unsigned long)cpuGetRegExternal(&cpu, 0), instrs, secs, instrs / secs / 1000000.0);
+
+	cpuDeinit(&cpu);
+	return 0;
+}
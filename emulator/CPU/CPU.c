@@ -120,6 +120,82 @@ static _INLINE_ void cpuPrvSetReg(ArmCpu* cpu, UInt8 reg, UInt32 val){
 	else cpu->regs[reg] = val;
 }
 
+static _INLINE_ Boolean cpuPrvSignedAdditionOverflows(UInt32 a, UInt32 b, UInt32 sum){
+	
+	return ((a ^ b ^ 0x80000000UL) & (a ^ sum)) >> 31;
+}
+
+static _INLINE_ Boolean cpuPrvSignedSubtractionOverflows(UInt32 a, UInt32 b, UInt32 diff){	//diff = a - b
+	
+	return ((a ^ b) & (a ^ diff)) >> 31;
+}
+
+/*
+	flags are evaluated lazily. flag setting instrs only record the result and whatever carry and overflow they produced,
+	and NZCV in CPSR are brought up to date by cpuPrvFlagsSync() once something needs the whole CPSR (MRS, MSR,
+	exceptions, debugger). conditions and carry-in are worked out from the record directly. anything that writes NZCV
+	in CPSR by hand must sync first or drop the record
+*/
+
+#define ARM_FLAGS_SYNCED	0	//NZCV in CPSR are current
+#define ARM_FLAGS_LAZY		1	//N and Z from flagsRes, C = flagsC, V is bit 31 of flagsV
+
+static _INLINE_ Boolean cpuPrvFlagC(ArmCpu* cpu){
+	
+	return (cpu->flagsOp == ARM_FLAGS_SYNCED) ? ((cpu->CPSR & ARM_SR_C) != 0) : cpu->flagsC;
+}
+
+static _INLINE_ UInt32 cpuPrvFlagsNZCV(ArmCpu* cpu){	//as a nibble, NZCV in bits 3..0
+	
+	if(cpu->flagsOp == ARM_FLAGS_SYNCED) return cpu->CPSR >> 28;
+	
+	return ((cpu->flagsRes >> 28) & 8) | (cpu->flagsRes ? 0 : 4) | (cpu->flagsC << 1) | (cpu->flagsV >> 31);
+}
+
+static _INLINE_ void cpuPrvFlagsSync(ArmCpu* cpu){
+	
+	if(cpu->flagsOp != ARM_FLAGS_SYNCED){
+		
+		cpu->CPSR = (cpu->CPSR &~ (ARM_SR_N | ARM_SR_Z | ARM_SR_C | ARM_SR_V)) | (cpuPrvFlagsNZCV(cpu) << 28);
+		cpu->flagsOp = ARM_FLAGS_SYNCED;
+	}
+}
+
+static _INLINE_ void cpuPrvFlagsKeepCV(ArmCpu* cpu){	//about to record an op that leaves C and/or V alone
+	
+	if(cpu->flagsOp == ARM_FLAGS_SYNCED){
+		
+		cpu->flagsC = (cpu->CPSR & ARM_SR_C) ? 1 : 0;
+		cpu->flagsV = cpu->CPSR << 3;
+		cpu->flagsOp = ARM_FLAGS_LAZY;
+	}
+}
+
+static _INLINE_ UInt32 cpuPrvFlagsAdd(ArmCpu* cpu, UInt32 a, UInt32 b, Boolean carryIn){	//a + b + carryIn, setting NZCV. subtractions add ~b with carry in set
+	
+	UInt32 res = a + b + (carryIn ? 1 : 0);
+	
+	cpu->flagsRes = res;
+	cpu->flagsC = carryIn ? (res <= a) : (res < a);
+	cpu->flagsV = (a ^ b ^ 0x80000000UL) & (a ^ res);
+	cpu->flagsOp = ARM_FLAGS_LAZY;
+	
+	return res;
+}
+
+static _INLINE_ void cpuPrvFlagsLogic(ArmCpu* cpu, UInt32 res, Boolean carryOut){	//sets N, Z and C, V stays
+	
+	cpuPrvFlagsKeepCV(cpu);
+	cpu->flagsRes = res;
+	cpu->flagsC = carryOut;
+}
+
+static _INLINE_ void cpuPrvFlagsNZ(ArmCpu* cpu, UInt32 res){	//sets N and Z, C and V stay
+	
+	cpuPrvFlagsKeepCV(cpu);
+	cpu->flagsRes = res;
+}
+
 UInt32 cpuGetRegExternal(ArmCpu* cpu, UInt8 reg){
 
 	if(reg < 16){	// real reg
@@ -128,6 +204,7 @@ UInt32 cpuGetRegExternal(ArmCpu* cpu, UInt8 reg){
 	}
 	else if(reg == ARM_REG_NUM_CPSR){
 	
+		cpuPrvFlagsSync(cpu);
 		return cpu->CPSR;
 	}
 	else if(reg == ARM_REG_NUM_SPSR){
@@ -222,6 +299,7 @@ static void cpuPrvHandleMemErr(ArmCpu* cpu, UInt32 addr, _UNUSED_ UInt8 sz, _UNU
 
 	if(cpu->setFaultAdrF) cpu->setFaultAdrF(cpu, addr, fsr);
 
+	cpuPrvFlagsSync(cpu);
 	if(instrFetch){
 		
 		//handle prefetch abort
@@ -237,7 +315,7 @@ static _INLINE_ UInt32 cpuPrvArmAdrMode_1(ArmCpu* cpu, UInt32 instr, Boolean* ca
 	
 	UInt32 ret;
 	UInt8 v, a;
-	Boolean co = ((cpu->CPSR & ARM_SR_C) != 0);	//be default carry out = C flag
+	Boolean co = cpuPrvFlagC(cpu);	//be default carry out = C flag
 
 	if(instr & 0x02000000UL){				//immed
 
@@ -458,7 +536,7 @@ static _INLINE_ UInt8 cpuPrvArmAdrMode_2(ArmCpu* cpu, UInt32 instr, UInt32* addB
 				}
 				else{	//RRX
 					val = val >> 1;
-					if(cpu->CPSR & ARM_SR_C) val |= 0x80000000UL;
+					if(cpuPrvFlagC(cpu)) val |= 0x80000000UL;
 				}
 		}
 			
@@ -641,8 +719,10 @@ static _INLINE_ void cpuPrvSetPSR(ArmCpu* cpu, UInt8 mask, Boolean privileged, B
 	}
 	else{
 		
-		UInt32 newCPSR = cpu->CPSR;
+		UInt32 newCPSR;
 		
+		cpuPrvFlagsSync(cpu);
+		newCPSR = cpu->CPSR;
 		if(privileged){
 			if(mask & 1){
 				
@@ -655,17 +735,203 @@ static _INLINE_ void cpuPrvSetPSR(ArmCpu* cpu, UInt8 mask, Boolean privileged, B
 		if(mask & 8) newCPSR = (newCPSR & 0x00FFFFFFUL) | (val & 0xFF000000UL);
 		
 		cpu->CPSR = newCPSR;
+		cpu->attention = true;	//this may have unmasked an interrupt
 	}
 }
 
-static _INLINE_ Boolean cpuPrvSignedAdditionOverflows(UInt32 a, UInt32 b, UInt32 sum){
+static _INLINE_ Boolean cpuPrvCondPasses(ArmCpu* cpu, UInt8 cond){	//cond 15 is not handled here
 	
-	return ((a ^ b ^ 0x80000000UL) & (a ^ sum)) >> 31;
+	static const UInt16 passes[16] = {0xF0F0, 0x0F0F, 0xCCCC, 0x3333, 0xFF00, 0x00FF, 0xAAAA, 0x5555, 0x0C0C, 0xF3F3, 0xAA55, 0x55AA, 0x0A05, 0xF5FA, 0xFFFF, 0x0000};	//bit N set if cond passes when NZCV == N
+	
+	return (passes[cond] >> cpuPrvFlagsNZCV(cpu)) & 1;
 }
 
-static _INLINE_ Boolean cpuPrvSignedSubtractionOverflows(UInt32 a, UInt32 b, UInt32 diff){	//diff = a - b
+static _INLINE_ Boolean cpuPrvDataProc(ArmCpu* cpu, UInt32 instr, UInt32 tmp /* shifter operand */, Boolean carryOut, Boolean usesUsrRegs, Boolean wasT, Boolean specialPC){	//false if invalid
 	
-	return ((a ^ b) & (a ^ diff)) >> 31;
+	Boolean S, store = true, logical = false;
+	UInt32 adr;
+	UInt8 va8, vb8;
+	
+	S = (instr & 0x00100000UL) != 0;
+	va8 = (instr >> 16) & 0x0F;
+	
+	switch((instr >> 21) & 0x0F){
+		case 0:			//AND
+			tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) & tmp;
+			logical = true;
+			break;
+		
+		case 1:			//EOR
+		
+			tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) ^ tmp;
+			logical = true;
+			break;
+		
+		case 2:			//SUB
+		
+			adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
+			tmp = S ? cpuPrvFlagsAdd(cpu, adr, ~tmp, true) : adr - tmp;
+			break;
+		
+		case 3:			//RSB
+		
+			adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
+			tmp = S ? cpuPrvFlagsAdd(cpu, tmp, ~adr, true) : tmp - adr;
+			break;
+		
+		case 4:			//ADD
+			
+			adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
+			tmp = S ? cpuPrvFlagsAdd(cpu, adr, tmp, false) : adr + tmp;
+			break;
+		
+		case 5:			//ADC
+		
+			adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
+			tmp = S ? cpuPrvFlagsAdd(cpu, adr, tmp, cpuPrvFlagC(cpu)) : adr + tmp + (cpuPrvFlagC(cpu) ? 1 : 0);
+			break;
+		
+		case 6:			//SBC
+		
+			adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
+			tmp = S ? cpuPrvFlagsAdd(cpu, adr, ~tmp, cpuPrvFlagC(cpu)) : adr + ~tmp + (cpuPrvFlagC(cpu) ? 1 : 0);
+			break;
+		
+		case 7:			//RSC
+		
+			adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
+			tmp = S ? cpuPrvFlagsAdd(cpu, tmp, ~adr, cpuPrvFlagC(cpu)) : tmp + ~adr + (cpuPrvFlagC(cpu) ? 1 : 0);
+			break;
+		
+		case 8:			//TST
+			if(!S) return false;
+			store = false;
+			tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) & tmp;
+			logical = true;
+			break;
+		
+		case 9:			//TEQ
+		
+			if(!S) return false;
+			store = false;
+			tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) ^ tmp;
+			logical = true;
+			break;
+		
+		case 10:		//CMP
+		
+			if(!S) return false;
+			store = false;
+			tmp = cpuPrvFlagsAdd(cpu, cpuPrvGetReg(cpu, va8, wasT, specialPC), ~tmp, true);
+			break;
+		
+		case 11:		//CMN
+		
+			if(!S) return false;
+			store = false;
+			tmp = cpuPrvFlagsAdd(cpu, cpuPrvGetReg(cpu, va8, wasT, specialPC), tmp, false);
+			break;
+		
+		case 12:		//ORR
+		
+			tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) | tmp;
+			logical = true;
+			break;
+		
+		case 13:		//MOV
+		
+			//tmp already equals tmp
+			logical = true;
+			break;
+		
+		case 14:		//BIC
+		
+			tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) & ~tmp;
+			logical = true;
+			break;
+		
+		case 15:		//MVN
+		
+			tmp = ~tmp;
+			logical = true;
+			break;
+	}
+	vb8 = (instr >> 12) & 0x0F;
+	if(S){	//update flags or restore CPSR
+		
+		if(!usesUsrRegs && vb8 == 15 && store){
+			
+			UInt32 sr;
+			
+			sr = cpu->SPSR;
+			cpuPrvSwitchToMode(cpu, sr & ARM_SR_M);
+			cpu->CPSR = sr;
+			cpu->flagsOp = ARM_FLAGS_SYNCED;	//flags came with the SPSR, forget what an arithmetic op above may have recorded
+			cpu->attention = true;
+			cpu->regs[15] = tmp;	//do it right here - if we let it use cpuPrvSetReg, it will check lower bit...
+			store = false;
+		}
+		else if(logical){	//arithmetic ops recorded their flags already
+			
+			cpuPrvFlagsLogic(cpu, tmp, carryOut);
+		}
+	}
+	if(store){
+		if(vb8 == 15){
+			cpuPrvSetReg(cpu, vb8, tmp &~ 1UL);
+			cpu->CPSR &=~ ARM_SR_T;
+			if(tmp & 1) cpu->CPSR |= ARM_SR_T;
+		}
+		else{
+			cpu->regs[vb8] = tmp;	//not pc - no need for func call cpuPrvSetReg(cpu, vb8, tmp);
+		}
+	}
+	
+	return true;
+}
+
+static _INLINE_ void cpuPrvLoadStoreMode_2(ArmCpu* cpu, UInt32 instr, UInt8 va8, UInt32 tmp /* add before */, UInt32 v32 /* add for writeback */, Boolean privileged, Boolean wasT, Boolean specialPC){
+	
+	UInt32 adr, m32;
+	UInt8 vb8, fsr;
+	Boolean ok;
+	
+	vb8 = (va8 & ARM_MODE_2_WORD) ? 4 : 1;	//get operation size
+	
+	adr = cpuPrvGetReg(cpu, va8 & ARM_MODE_2_REG, wasT, specialPC);
+	
+	if(va8 & ARM_MODE_2_LOAD){
+		
+		ok = cpu->memF(cpu, &m32, adr + tmp, vb8, false, privileged, &fsr);
+		if(!ok){
+			cpuPrvHandleMemErr(cpu, adr + tmp, vb8, false, false, fsr);
+			return;
+		}
+		if(vb8 == 1) m32 = *(UInt8*)&m32;	//endian-free way to make it a valid 8-bit value, if need be
+		tmp = m32;
+		cpuPrvSetReg(cpu, (instr >> 12) & 0x0F, tmp);
+		if(v32) cpuPrvSetReg(cpu, va8 & ARM_MODE_2_REG, v32 + adr);
+	}
+	else{
+		if(v32){
+			v32 += adr;
+			va8 |= ARM_MODE_2_INV;	//re-use flag to mean writeack
+		}
+		
+		adr += tmp;
+		if(vb8 == 1){
+			*(UInt8*)&m32 = cpuPrvGetReg(cpu, (instr >> 12) & 0x0F, wasT, specialPC);
+		}
+		else{
+			m32 = cpuPrvGetReg(cpu, (instr >> 12) & 0x0F, wasT, specialPC);
+		}
+		ok = cpu->memF(cpu, &m32, adr, vb8, true, privileged, &fsr);
+		if(!ok){
+			cpuPrvHandleMemErr(cpu, adr, vb8, true, false, fsr);
+			return;
+		}
+		if(va8 & ARM_MODE_2_INV) cpuPrvSetReg(cpu, va8 & ARM_MODE_2_REG, v32);
+	}
 }
 
 static _INLINE_ UInt32 cpuPrvMedia_signedSaturate32(UInt32 sign){
@@ -1215,6 +1481,7 @@ static Err cpuPrvExecInstr(ArmCpu* cpu, UInt32 instr, UInt32 instrPC/* lower bit
 	#else
 		fsr = (instr >> 29UL);
 	#endif
+		if(fsr != 7) cpuPrvFlagsSync(cpu);
 		switch(fsr){
 
 			case 0:		//EQ / NE
@@ -1396,13 +1663,7 @@ static Err cpuPrvExecInstr(ArmCpu* cpu, UInt32 instr, UInt32 instrPC/* lower bit
 					mul32:
 								tmp += cpuPrvGetReg(cpu, (instr >> 8) & 0x0F, wasT, specialPC) * cpuPrvGetReg(cpu, instr & 0x0F, wasT, specialPC);
 								cpuPrvSetReg(cpu, (instr >> 16) & 0x0F, tmp);
-								if(instr & 0x00100000UL){	//S
-									
-									adr = cpu->CPSR &~ (ARM_SR_Z | ARM_SR_N);
-									if(!tmp) adr |= ARM_SR_Z;
-									if(tmp & 0x80000000UL) adr |= ARM_SR_N;
-									cpu->CPSR = adr;
-								}
+								if(instr & 0x00100000UL) cpuPrvFlagsNZ(cpu, tmp);	//S
 								goto instr_done;
 							
 				#ifdef ARM_V6
@@ -1449,6 +1710,7 @@ static Err cpuPrvExecInstr(ArmCpu* cpu, UInt32 instr, UInt32 instrPC/* lower bit
 								
 								if(instr & 0x00100000UL){	//S
 									
+									cpuPrvFlagsSync(cpu);
 									adr = cpu->CPSR &~ (ARM_SR_Z | ARM_SR_N);
 									if(u64_isZero(v64)) adr |= ARM_SR_Z;
 									if(v32 & 0x80000000UL) adr |= ARM_SR_N;
@@ -1545,6 +1807,7 @@ static Err cpuPrvExecInstr(ArmCpu* cpu, UInt32 instr, UInt32 instrPC/* lower bit
 						
 							if((instr & 0x00BF0FFFUL) == 0x000F0000UL){	//move PSR to reg
 								
+								cpuPrvFlagsSync(cpu);
 								cpuPrvSetReg(cpu, (instr >> 12) & 0x0F, (instr & 0x00400000UL) ? cpu->SPSR : cpu->CPSR);	//access in user and sys mode is undefined. for us that means returning garbage that is currently in "cpu->SPSR"
 							}
 							else if((instr & 0x00B0FFF0UL) == 0x0020F000UL){	//move reg to PSR
@@ -1632,6 +1895,7 @@ static Err cpuPrvExecInstr(ArmCpu* cpu, UInt32 instr, UInt32 instrPC/* lower bit
 							
 						case 7:					//soft breakpoint
 					
+							cpuPrvFlagsSync(cpu);
 							cpuPrvException(cpu, cpu->vectorBase + ARM_VECTOR_OFFT_P_ABT, instrPC + 4, ARM_CPSR_PAB_ORR | (cpu->CPSR & ARM_CPSR_PAB_ORR));
 							goto instr_done;
 						
@@ -1797,183 +2061,10 @@ static Err cpuPrvExecInstr(ArmCpu* cpu, UInt32 instr, UInt32 instrPC/* lower bit
 				
 data_processing:							//data processing
 				{
-					Boolean carryOut, carryIn, V, S, store = true;
-					S = (instr & 0x00100000UL) != 0;
-					V = (cpu->CPSR & ARM_SR_V) != 0;
-					carryIn = (cpu->CPSR & ARM_SR_C) != 0;
-					tmp = cpuPrvArmAdrMode_1(cpu, instr, &carryOut, wasT, specialPC);
-					va8 = (instr >> 16) & 0x0F;
+					Boolean carryOut;
 					
-					switch((instr >> 21) & 0x0F){
-						case 0:			//AND
-							tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) & tmp;
-							break;
-						
-						case 1:			//EOR
-						
-							tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) ^ tmp;
-							break;
-						
-						case 2:			//SUB
-						
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							v32 = adr - tmp;
-							if(S) V = cpuPrvSignedSubtractionOverflows(adr, tmp, v32);
-							if(S) carryOut = adr >= tmp;
-							tmp = v32;
-							break;
-						
-						case 3:			//RSB
-						
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							v32 = tmp - adr;
-							if(S) V = cpuPrvSignedSubtractionOverflows(tmp, adr, v32);
-							if(S) carryOut = tmp >= adr;
-							tmp = v32;
-							break;
-						
-						case 4:			//ADD
-							
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							v32 = adr + tmp;
-							if(S) V = cpuPrvSignedAdditionOverflows(adr, tmp, v32);
-							if(S) carryOut = v32 < adr;
-							tmp = v32;
-							break;
-						
-						case 5:			//ADC
-						
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							if(carryIn){
-								v32 = adr + tmp + 1;
-								if(S) carryOut = v32 <= adr;
-							}
-							else{
-								v32 = adr + tmp;
-								if(S) carryOut = v32 < adr;
-							}
-							if(S) V = cpuPrvSignedAdditionOverflows(adr, tmp, v32);
-							tmp = v32;
-							break;
-						
-						case 6:			//SBC
-						
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							if(carryIn){
-								
-								v32 = adr - tmp;
-								if(S) carryOut = adr >= tmp;
-							}
-							else{
-								v32 = adr - tmp - 1;
-								if(S) carryOut = adr > tmp;
-							}
-							if(S) V = cpuPrvSignedSubtractionOverflows(adr, tmp, v32);
-							tmp = v32;
-							break;
-						
-						case 7:			//RSC
-						
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							if(carryIn){
-								
-								v32 = tmp - adr;
-								if(S) carryOut = tmp >= adr;
-							}
-							else{
-								v32 = tmp - adr - 1;
-								if(S) carryOut = tmp > adr;
-							}
-							if(S) V = cpuPrvSignedSubtractionOverflows(tmp, adr, v32);
-							tmp = v32;
-							break;
-						
-						case 8:			//TST
-							if(!S) goto invalid_instr;
-							store = false;
-							tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) & tmp;
-							break;
-						
-						case 9:			//TEQ
-						
-							if(!S) goto invalid_instr;
-							store = false;
-							tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) ^ tmp;
-							break;
-						
-						case 10:		//CMP
-						
-							if(!S) goto invalid_instr;
-							store = false;
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							V = cpuPrvSignedSubtractionOverflows(adr, tmp, adr - tmp);	//((adr ^ tmp) & (adr ^ (adr - tmp))) >> 31;
-							carryOut = adr >= tmp;
-							tmp = adr - tmp;
-							break;
-						
-						case 11:		//CMN
-						
-							if(!S) goto invalid_instr;
-							store = false;
-							adr = cpuPrvGetReg(cpu, va8, wasT, specialPC);
-							v32 = adr + tmp;
-							V = cpuPrvSignedAdditionOverflows(adr, tmp, v32);
-							carryOut = v32 < adr;
-							tmp = v32;
-							break;
-						
-						case 12:		//ORR
-						
-							tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) | tmp;
-							break;
-						
-						case 13:		//MOV
-						
-							//tmp already equals tmp
-							break;
-						
-						case 14:		//BIC
-						
-							tmp = cpuPrvGetReg(cpu, va8, wasT, specialPC) & ~tmp;
-							break;
-						
-						case 15:		//MVN
-						
-							tmp = ~tmp;
-							break;
-					}
-					vb8 = (instr >> 12) & 0x0F;
-					if(S){	//update flags or restore CPSR
-						
-						if(!usesUsrRegs && vb8 == 15 && store){
-							
-							UInt32 sr;
-							
-							sr = cpu->SPSR;
-							cpuPrvSwitchToMode(cpu, sr & ARM_SR_M);
-							cpu->CPSR = sr;
-							cpu->regs[15] = tmp;	//do it right here - if we let it use cpuPrvSetReg, it will check lower bit...
-							store = false;
-						}
-						else{
-							adr = cpu->CPSR &~ (ARM_SR_Z | ARM_SR_N | ARM_SR_C | ARM_SR_V);
-							if(!tmp) adr |= ARM_SR_Z;
-							if(tmp & 0x80000000UL) adr |= ARM_SR_N;
-							if(carryOut) adr |= ARM_SR_C;
-							if(V) adr |= ARM_SR_V;
-							cpu->CPSR = adr;
-						}
-					}
-					if(store){
-						if(vb8 == 15){
-							cpuPrvSetReg(cpu, vb8, tmp &~ 1UL);
-							cpu->CPSR &=~ ARM_SR_T;
-							if(tmp & 1) cpu->CPSR |= ARM_SR_T;
-						}
-						else{
-							cpu->regs[vb8] = tmp;	//not pc - no need for func call cpuPrvSetReg(cpu, vb8, tmp);
-						}
-					}
+					tmp = cpuPrvArmAdrMode_1(cpu, instr, &carryOut, wasT, specialPC);
+					if(!cpuPrvDataProc(cpu, instr, tmp, carryOut, usesUsrRegs, wasT, specialPC)) goto invalid_instr;
 					goto instr_done;
 				}
 				break;
@@ -2003,47 +2094,9 @@ load_store_mode_2:
 				}
 				
 				va8 = cpuPrvArmAdrMode_2(cpu, instr, &m32, &x32, wasT, specialPC);
-				tmp = m32;
-				v32 = x32;
 				if(va8 & ARM_MODE_2_INV) goto invalid_instr;
 				if(va8 & ARM_MODE_2_T) privileged = false;
-				vb8 = (va8 & ARM_MODE_2_WORD) ? 4 : 1;	//get operation size
-				
-				adr = cpuPrvGetReg(cpu, va8 & ARM_MODE_2_REG, wasT, specialPC);
-				
-				if(va8 & ARM_MODE_2_LOAD){
-					
-					ok = cpu->memF(cpu, &m32, adr + tmp, vb8, false, privileged, &fsr);
-					if(!ok){
-						cpuPrvHandleMemErr(cpu, adr + tmp, vb8, false, false, fsr);
-						goto instr_done;
-					}
-					if(vb8 == 1) m32 = *(UInt8*)&m32;	//endian-free way to make it a valid 8-bit value, if need be
-					tmp = m32;
-					cpuPrvSetReg(cpu, (instr >> 12) & 0x0F, tmp);
-					if(v32) cpuPrvSetReg(cpu, va8 & ARM_MODE_2_REG, v32 + adr);
-				}
-				else{
-					if(v32){
-						v32 += adr;
-						va8 |= ARM_MODE_2_INV;	//re-use flag to mean writeack
-					}
-					
-					adr += tmp;
-					if(vb8 == 1){
-						*(UInt8*)&m32 = cpuPrvGetReg(cpu, (instr >> 12) & 0x0F, wasT, specialPC);
-					}
-					else{
-						m32 = cpuPrvGetReg(cpu, (instr >> 12) & 0x0F, wasT, specialPC);
-					}
-					ok = cpu->memF(cpu, &m32, adr, vb8, true, privileged, &fsr);
-					if(!ok){
-						cpuPrvHandleMemErr(cpu, adr, vb8, true, false, fsr);
-						goto instr_done;
-					}
-					if(va8 & ARM_MODE_2_INV) cpuPrvSetReg(cpu, va8 & ARM_MODE_2_REG, v32);
-				}
-				
+				cpuPrvLoadStoreMode_2(cpu, instr, va8, m32, x32, privileged, wasT, specialPC);
 				goto instr_done;
 
 			case 8:
@@ -2131,7 +2184,9 @@ load_store_mode_2:
 				if(specialInstr){		//process LDM(3) SPSR->CPSR copy
 					v32 = cpu->SPSR;
 					cpuPrvSwitchToMode(cpu, v32 & ARM_SR_M);
-					cpu->CPSR = v32;	
+					cpu->CPSR = v32;
+					cpu->flagsOp = ARM_FLAGS_SYNCED;
+					cpu->attention = true;
 				}
 				else if((v16 & 0x8000U) && !(va8 & ARM_MODE_4_S)){	//we just loaded PC
 					if(cpu->regs[15] & 1){
@@ -2217,6 +2272,7 @@ load_store_mode_2:
 
 				if(specialInstr) goto invalid_instr;
 
+				cpuPrvFlagsSync(cpu);
 				cpuPrvException(cpu, cpu->vectorBase + ARM_VECTOR_OFFT_SWI, instrPC + (wasT ? 2 : 4), ARM_CPSR_SWI_ORR | (cpu->CPSR & ARM_CPSR_SWI_AND));
 				goto instr_done;
 		}
@@ -2227,6 +2283,7 @@ load_store_mode_2:
 			if(cpu->hypercallF && cpu->hypercallF(cpu)) goto instr_done;
 		}
 
+		cpuPrvFlagsSync(cpu);
 		err_str("Invalid instr 0x");
 		err_hex(instr);
 		err_str(" seen at 0x");
@@ -2242,43 +2299,13 @@ load_store_mode_2:
 	return errNone;
 }
 
-static Err cpuPrvCycleArm(ArmCpu* cpu){
-	
-	Boolean privileged, ok;
-	UInt32 instr, pc;
-	UInt8 fsr;
-
-	privileged = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
-	//fetch instruction
-	{
-		ok = icacheFetch(&cpu->ic, pc = cpu->regs[15], 4, privileged, &fsr, &instr);
-		if(!ok){
-			cpuPrvHandleMemErr(cpu, cpu->regs[15], 4, false, true, fsr);
-			return errNone;						//exit here so that debugger can see us execute first instr of execption handler
-		}
-		cpu->regs[15] += 4;
-	}
-	
-	return cpuPrvExecInstr(cpu, instr, pc, false, privileged, false);
-}
-
-
-static Err cpuPrvCycleThumb(ArmCpu* cpu){
-	
-	Boolean privileged, vB, specialPC = false, ok;
-	UInt32 t, instr = 0xE0000000UL /*most likely thing*/, pc;
-	UInt16 instrT, v16;
-	UInt8 v8, fsr;
-
-	privileged = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
+//converts a thumb instr to the equivalent ARM instr, for the dynarec and the rare instrs cpuPrvExecThumb() does not run itself. returns false for the few that have none
+static _INLINE_ Boolean cpuPrvThumbToArm(UInt16 instrT, UInt32* instrP, Boolean* specialPCP){
 	
-	pc = cpu->regs[15];
-	ok = icacheFetch(&cpu->ic, pc, 2, privileged, &fsr, &instrT);
-	if(!ok){
-		cpuPrvHandleMemErr(cpu, pc, 2, false, true, fsr);
-		return errNone;						//exit here so that debugger can see us execute first instr of execption handler
-	}
-	cpu->regs[15] += 2;
+	Boolean vB, specialPC = false;
+	UInt32 instr = 0xE0000000UL /*most likely thing*/;
+	UInt16 v16;
+	UInt8 v8;
 	
 	switch(instrT >> 12){
 		
@@ -2334,57 +2361,13 @@ static Err cpuPrvCycleThumb(ArmCpu* cpu){
 			}
 			else if(instrT & 0x0400){		// ADD(4) CMP(3) MOV(3) BX
 				
-				UInt8 vD;
+				if(((instrT >> 8) & 3) != 1) return false;	// ADD(4) MOV(3) BX need special PC handling
 				
-				vD = (instrT & 7) | ((instrT >> 4) & 0x08);
-				v8 = (instrT >> 3) & 0xF;
-				
-				switch((instrT >> 8) & 3){
-					
-					case 0:			// ADD(4)
-						
-						//special handling required for PC destination
-						t = cpuPrvGetReg(cpu, vD, true, false) + cpuPrvGetReg(cpu, v8, true, false);
-						if (vD == 15)
-							t |= 1;
-						cpuPrvSetReg(cpu, vD, t);
-						goto instr_done;
-						break;
-					
-					case 1:			// CMP(3)
-						
-						instr |= 0x01500000UL | (((UInt32)vD) << 16) | v8;
-						break;
-					
-					case 2:			// MOV(3)
-						
-						//special handling required for PC destination
-						t = cpuPrvGetReg(cpu, v8, true, false);
-						if (vD == 15)
-							t |= 1;
-						cpuPrvSetReg(cpu, vD, t);
-						goto instr_done;
-					
-					case 3:			// BX
-						
-						if (instrT & 0x80)	//BLX
-							cpu->regs[14] = cpu->regs[15] + 1;
-	
-						if(instrT == 0x4778){	//special handing for thumb's "BX PC" as aparently docs are wrong on it
-							
-							cpuPrvSetPC(cpu, (cpu->regs[15] + 2) &~ 3UL);
-							goto instr_done;
-						}
-						
-						instr |= 0x012FFF10UL | ((instrT >> 3) & 0x0F);
-						break;
-					
-					default:
-						goto undefined;
-				}
-			}
-			else{					// AND EOR LSL(2) LSR(2) ASR(2) ADC SBC ROR TST NEG CMP(2) CMN ORR MUL BIC MVN (in val_tabl order)
-				static const UInt32 val_tabl[16] = {0x00100000UL, 0x00300000UL, 0x01B00010UL, 0x01B00030UL, 0x01B00050UL, 0x00B00000UL, 0x00D00000UL, 0x01B00070UL, 0x01100000UL, 0x02700000UL, 0x01500000UL, 0x01700000UL, 0x01900000UL, 0x00100090UL, 0x01D00000UL, 0x01F00000UL};
+				// CMP(3)
+				instr |= 0x01500000UL | (((UInt32)((instrT & 7) | ((instrT >> 4) & 0x08))) << 16) | ((instrT >> 3) & 0xF);
+			}
+			else{					// AND EOR LSL(2) LSR(2) ASR(2) ADC SBC ROR TST NEG CMP(2) CMN ORR MUL BIC MVN (in val_tabl order)
+				static const UInt32 val_tabl[16] = {0x00100000UL, 0x00300000UL, 0x01B00010UL, 0x01B00030UL, 0x01B00050UL, 0x00B00000UL, 0x00D00000UL, 0x01B00070UL, 0x01100000UL, 0x02700000UL, 0x01500000UL, 0x01700000UL, 0x01900000UL, 0x00100090UL, 0x01D00000UL, 0x01F00000UL};
 				
 				//00 = none
 				//10 = bit0 val
@@ -2443,8 +2426,10 @@ static Err cpuPrvCycleThumb(ArmCpu* cpu){
 		case 10:	// ADD(5) ADD(6)	(bit11 set = add(6))
 			
 			instr |= ((instrT & 0x700) << 4) | (instrT &0xFF) | 0x028D0F00UL;	//encode add to SP, line below sets the bit needed to reference PC instead when needed)
-			if(!(instrT & 0x0800)) instr |= 0x00020000UL;
-			else specialPC = true;
+			if(!(instrT & 0x0800)){
+				instr |= 0x00020000UL;
+				specialPC = true;	//PC is seen word-aligned
+			}
 			break;
 		
 		case 11:	// ADD(7) SUB(4) PUSH POP BKPT
@@ -2577,24 +2562,8 @@ static Err cpuPrvCycleThumb(ArmCpu* cpu){
 					if(instrT & 0x0400) instr |= 0x00FFF800UL;
 					break;
 				
-				case 1:		//BLX(1)_suffix
-					instr = cpu->regs[15];
-					cpu->regs[15] = (cpu->regs[14] + 2 + (((UInt32)v16) << 1)) &~ 3UL;
-					cpu->regs[14] = instr | 1UL;
-					cpu->CPSR &=~ ARM_SR_T;
-					goto instr_done;
-				
-				case 2:		//BLX(1)_prefix BL_prefix
-					instr = v16;
-					if(instrT & 0x0400) instr |= 0x000FF800UL;
-					cpu->regs[14] = cpu->regs[15] + (instr << 12);
-					goto instr_done;
-				
-				case 3:		//BL_suffix
-					instr = cpu->regs[15];
-					cpu->regs[15] = cpu->regs[14] + 2 + (((UInt32)v16) << 1);
-					cpu->regs[14] = instr | 1UL;
-					goto instr_done;
+				default:	//BLX(1)_suffix BLX(1)_prefix BL_prefix BL_suffix
+					return false;
 			}
 			
 			if(instrT & 0x0800) goto undefined;	//avoid BLX_suffix and undefined instr space in there
@@ -2604,9 +2573,9 @@ static Err cpuPrvCycleThumb(ArmCpu* cpu){
 	}
 
 instr_execute:
-	return cpuPrvExecInstr(cpu, instr, pc, true, privileged, specialPC);
-instr_done:
-	return errNone;
+	*instrP = instr;
+	*specialPCP = specialPC;
+	return true;
 undefined:
 	if(instrT == HYPERCALL_THUMB){
 		instr = HYPERCALL_ARM;
@@ -2617,144 +2586,1066 @@ undefined:
 	goto instr_execute;
 }
 
-Err cpuInit(ArmCpu* cpu, UInt32 pc, ArmCpuMemF memF, ArmCpuEmulErr emulErrF, ArmCpuHypercall hypercallF, ArmSetFaultAdrF setFaultAdrF){
+static _INLINE_ UInt32 cpuPrvThumbShift(ArmCpu* cpu, UInt8 type /* LSL LSR ASR ROR */, UInt32 val, UInt8 amt){	//sets NZC. immediate shifts by 32 come here as 32
 	
-	if(!TYPE_CHECK){
-		emulErrF(cpu, "Type size error! CPU init aborted");
-		return errInternal;
-	}
-
-	__mem_zero(cpu, sizeof(ArmCpu));
+	Boolean co = cpuPrvFlagC(cpu);
 	
-	cpu->CPSR = ARM_SR_I | ARM_SR_F | ARM_SR_MODE_SVC;	//start w/o interrupts in supervisor mode
-	cpuPrvSetPC(cpu, pc);
-
-	cpu->memF = memF;
-	cpu->emulErrF = emulErrF;
-	cpu->hypercallF = hypercallF;
-	cpu->setFaultAdrF = setFaultAdrF;
-
-	icacheInit(&cpu->ic, cpu, memF);
-
-	return errNone;
-}
-
-Err cpuDeinit(_UNUSED_ ArmCpu* cpu){
-
-	return errNone;
-}
-
-void cpuCycle(ArmCpu* cpu){
-
-	UInt32 vector, newCPSR;
-
-	if(cpu->waitingFiqs && !(cpu->CPSR & ARM_SR_F)){
+	if(amt) switch(type){
 		
-		newCPSR = ARM_CPSR_FIQ_ORR | (cpu->CPSR & ARM_CPSR_FIQ_AND);
-		vector = cpu->vectorBase + ARM_VECTOR_OFFT_FIQ;
-	}
-	else if(cpu->waitingIrqs && !(cpu->CPSR & ARM_SR_I)){
+		case 0:			//LSL
+			
+			if(amt < 32){
+				co = (val >> (32 - amt)) & 1;
+				val <<= amt;
+			}
+			else{
+				co = (amt == 32) ? (val & 1) : 0;
+				val = 0;
+			}
+			break;
 		
-		newCPSR = ARM_CPSR_IRQ_ORR | (cpu->CPSR & ARM_CPSR_IRQ_AND);
-		vector = cpu->vectorBase + ARM_VECTOR_OFFT_IRQ;
-	}
-#ifdef ARM_V6
-	else if(cpu->impreciseAbtWaiting && !(cpu->CPSR & ARM_SR_A)){
+		case 1:			//LSR
+			
+			if(amt < 32){
+				co = (val >> (amt - 1)) & 1;
+				val >>= amt;
+			}
+			else{
+				co = (amt == 32) ? (val >> 31) : 0;
+				val = 0;
+			}
+			break;
 		
-		newCPSR = ARM_CPSR_DAB_ORR | (cpu->CPSR & ARM_CPSR_DAB_AND);
-		vector = cpu->vectorBase + ARM_VECTOR_OFFT_D_ABT;
-	}
-#endif
-	else{
-		goto normal;
+		case 2:			//ASR
+			
+			if(amt < 32){
+				co = (val >> (amt - 1)) & 1;
+				val = (Int32)val >> amt;
+			}
+			else{
+				co = val >> 31;
+				val = co ? 0xFFFFFFFFUL : 0;
+			}
+			break;
+		
+		case 3:			//ROR
+			
+			amt &= 0x1F;
+			if(!amt){
+				co = val >> 31;
+			}
+			else{
+				co = (val >> (amt - 1)) & 1;
+				val = cpuPrvROR(val, amt);
+			}
+			break;
 	}
+	
+	cpuPrvFlagsLogic(cpu, val, co);
+	
+	return val;
+}
 
-	cpuPrvException(cpu, vector, cpu->regs[15] + 4, newCPSR);
-
-normal:
-
-	if(cpu->CPSR & ARM_SR_T){
-		cpuPrvCycleThumb(cpu);
+static _INLINE_ void cpuPrvThumbLoad(ArmCpu* cpu, UInt8 reg, UInt32 adr, UInt8 sz, Boolean signExtend, Boolean privileged){
+	
+	UInt32 m32;
+	UInt16* m16 = (UInt16*)&m32;
+	UInt8 fsr;
+	
+	if(!cpu->memF(cpu, &m32, adr, sz, false, privileged, &fsr)){
+		cpuPrvHandleMemErr(cpu, adr, sz, false, false, fsr);
+		return;
 	}
-	else{
-		
-		cpuPrvCycleArm(cpu);
+	if(sz == 1){
+		m32 = *(UInt8*)&m32;	//endian-free way to make it a valid 8-bit value
+		if(signExtend && (m32 & 0x80)) m32 |= 0xFFFFFF00UL;
 	}
+	else if(sz == 2){
+		m32 = *m16;
+		if(signExtend && (m32 & 0x8000UL)) m32 |= 0xFFFF0000UL;
+	}
+	cpu->regs[reg] = m32;
 }
 
-void cpuIrq(ArmCpu* cpu, Boolean fiq, Boolean raise){	//unraise when acknowledged
+static _INLINE_ void cpuPrvThumbStore(ArmCpu* cpu, UInt32 val, UInt32 adr, UInt8 sz, Boolean privileged){
+	
+	UInt32 m32;
+	UInt16* m16 = (UInt16*)&m32;
+	UInt8 fsr;
+	
+	if(sz == 1) *(UInt8*)&m32 = val;
+	else if(sz == 2) *m16 = val;
+	else m32 = val;
+	
+	if(!cpu->memF(cpu, &m32, adr, sz, true, privileged, &fsr)) cpuPrvHandleMemErr(cpu, adr, sz, true, false, fsr);
+}
 
-	if(fiq){
-		if(raise){
-			cpu->waitingFiqs++;
-		}
-		else if(cpu->waitingFiqs){
-			cpu->waitingFiqs--;
-		}
-		else{
-			cpu->emulErrF(cpu,"Cannot unraise FIQ when none raised");
+static _INLINE_ void cpuPrvThumbLoadStoreMultiple(ArmCpu* cpu, UInt8 baseReg, UInt16 regs, Boolean load, Boolean inc /* IA, else DB */, Boolean writeback, Boolean privileged){
+	
+	UInt32 adr, base;
+	UInt8 i, reg, fsr;
+	
+	adr = base = cpu->regs[baseReg];
+	
+	for(i = 0; i < 16; i++){
+		
+		reg = inc ? i : 15 - i;
+		if(!(regs & (1UL << reg))) continue;
+		
+		if(!inc) adr -= 4;
+		if(!cpu->memF(cpu, cpu->regs + reg, adr, 4, !load, privileged, &fsr)){
+			cpuPrvHandleMemErr(cpu, adr, 4, !load, false, fsr);
+			if(regs & (1UL << baseReg)) cpu->regs[baseReg] = base;
+			return;
 		}
+		if(inc) adr += 4;
 	}
-	else{
-		if(raise){
-			cpu->waitingIrqs++;
-		}
-		else if(cpu->waitingIrqs){
-			cpu->waitingIrqs--;
+	if(writeback) cpu->regs[baseReg] = adr;
+	
+	if(load && (regs & 0x8000U)){	//POP {PC} may switch back to ARM mode
+		
+		if(cpu->regs[15] & 1){
+			cpu->regs[15] &=~ 1UL;
 		}
 		else{
-			cpu->emulErrF(cpu,"Cannot unraise IRQ when none raised");
+			cpu->CPSR &=~ ARM_SR_T;
 		}
 	}
 }
 
-void cpuIcacheInval(ArmCpu* cpu){
-
-	icacheInval(&cpu->ic);
-}
-
-void cpuIcacheInvalAddr(ArmCpu* cpu, UInt32 addr){
-
-	icacheInvalAddr(&cpu->ic, addr);
-}
-
-
-void cpuCoprocessorRegister(ArmCpu* cpu, UInt8 cpNum, ArmCoprocessor* coproc){
-
-	cpu->coproc[cpNum] = *coproc;
-}
-
-void cpuCoprocessorUnregister(ArmCpu* cpu, UInt8 cpNum){
-
-	ArmCoprocessor cp;
-
-	__mem_zero(&cp, sizeof(ArmCoprocessor));
-
-	cpu->coproc[cpNum] = cp;	
-}
-
-void cpuSetVectorAddr(ArmCpu* cpu, UInt32 adr){
+static Err cpuPrvExecThumb(ArmCpu* cpu, UInt16 instrT, UInt32 pc, Boolean privileged){	//works on the thumb encoding directly, only the rare instrs get converted to ARM
 	
-	cpu->vectorBase = adr;	
-}
-
-UInt16 cpuGetCPAR(ArmCpu* cpu){
+	static const UInt8 sizes[8] = {4, 2, 1, 1, 4, 2, 1, 2};	//STR STRH STRB LDRSB LDR LDRH LDRB LDRSH
+	UInt32 t, instr, *regs = cpu->regs;
+	Boolean specialPC;
+	UInt16 v16;
+	UInt8 vD, v8;
 	
-	return cpu->CPAR;	
-}
-
-void cpuSetCPAR(ArmCpu* cpu, UInt16 cpar){
-
-	cpu->CPAR = cpar;	
-}
-
-#ifdef ARM_V6
-
-	void cpuSignalImpreciseAbt(ArmCpu* cpu, Boolean raise){
+	switch(instrT >> 12){
 		
-		cpu->impreciseAbtWaiting = raise;
-	}
-
-
-#endif
-
+		case 0:		// LSL(1) LSR(1) ASR(1) ADD(1) SUB(1) ADD(3) SUB(3)
+		case 1:
+			
+			vD = instrT & 7;
+			v8 = (instrT >> 3) & 7;
+			
+			if((instrT & 0x1800) != 0x1800){	// LSL(1) LSR(1) ASR(1)
+				
+				t = (instrT >> 6) & 0x1F;
+				if(!t && (instrT & 0x1800)) t = 32;	//LSR and ASR encode a shift by 32 as 0
+				regs[vD] = cpuPrvThumbShift(cpu, (instrT >> 11) & 3, regs[v8], t);
+			}
+			else{
+				t = (instrT >> 6) & 7;
+				if(!(instrT & 0x0400)) t = regs[t];	// ADD(3) SUB(3) take a reg
+				
+				if(instrT & 0x0200) regs[vD] = cpuPrvFlagsAdd(cpu, regs[v8], ~t, true);
+				else regs[vD] = cpuPrvFlagsAdd(cpu, regs[v8], t, false);
+			}
+			break;
+		
+		case 2:		// MOV(1) CMP(1) ADD(2) SUB(2)
+		case 3:
+			
+			vD = (instrT >> 8) & 7;
+			t = instrT & 0xFF;
+			
+			switch((instrT >> 11) & 3){
+				
+				case 0:				// MOV(1)
+					regs[vD] = t;
+					cpuPrvFlagsNZ(cpu, t);
+					break;
+				
+				case 1:				// CMP(1)
+					cpuPrvFlagsAdd(cpu, regs[vD], ~t, true);
+					break;
+				
+				case 2:				// ADD(2)
+					regs[vD] = cpuPrvFlagsAdd(cpu, regs[vD], t, false);
+					break;
+				
+				case 3:				// SUB(2)
+					regs[vD] = cpuPrvFlagsAdd(cpu, regs[vD], ~t, true);
+					break;
+			}
+			break;
+		
+		case 4:		// LDR(3) ADD(4) CMP(3) MOV(3) BX MVN CMP(2) CMN TST ADC SBC NEG MUL LSL(2) LSR(2) ASR(2) ROR AND EOR ORR BIC
+			
+			if(instrT & 0x0800){			// LDR(3)
+				
+				cpuPrvThumbLoad(cpu, (instrT >> 8) & 7, ((pc + 4) &~ 3UL) + ((instrT & 0xFF) << 2), 4, false, privileged);
+			}
+			else if(instrT & 0x0400){		// ADD(4) CMP(3) MOV(3) BX
+				
+				vD = (instrT & 7) | ((instrT >> 4) & 0x08);
+				v8 = (instrT >> 3) & 0xF;
+				
+				switch((instrT >> 8) & 3){
+					
+					case 0:			// ADD(4)
+						
+						//special handling required for PC destination
+						t = cpuPrvGetReg(cpu, vD, true, false) + cpuPrvGetReg(cpu, v8, true, false);
+						if (vD == 15)
+							t |= 1;
+						cpuPrvSetReg(cpu, vD, t);
+						break;
+					
+					case 1:			// CMP(3)
+						
+						cpuPrvFlagsAdd(cpu, cpuPrvGetReg(cpu, vD, true, false), ~cpuPrvGetReg(cpu, v8, true, false), true);
+						break;
+					
+					case 2:			// MOV(3)
+						
+						//special handling required for PC destination
+						t = cpuPrvGetReg(cpu, v8, true, false);
+						if (vD == 15)
+							t |= 1;
+						cpuPrvSetReg(cpu, vD, t);
+						break;
+					
+					case 3:			// BX
+						
+						if (instrT & 0x80)	//BLX
+							regs[14] = regs[15] + 1;
+						
+						if(instrT == 0x4778){	//special handing for thumb's "BX PC" as aparently docs are wrong on it
+							
+							cpuPrvSetPC(cpu, (regs[15] + 2) &~ 3UL);
+							break;
+						}
+						
+						cpuPrvSetPC(cpu, cpuPrvGetReg(cpu, v8, true, false));
+						break;
+				}
+			}
+			else{					// AND EOR LSL(2) LSR(2) ASR(2) ADC SBC ROR TST NEG CMP(2) CMN ORR MUL BIC MVN
+				
+				vD = instrT & 7;
+				t = regs[(instrT >> 3) & 7];
+				
+				switch((instrT >> 6) & 0x0F){
+					
+					case 0:			// AND
+						regs[vD] &= t;
+						cpuPrvFlagsNZ(cpu, regs[vD]);
+						break;
+					
+					case 1:			// EOR
+						regs[vD] ^= t;
+						cpuPrvFlagsNZ(cpu, regs[vD]);
+						break;
+					
+					case 2:			// LSL(2)
+						regs[vD] = cpuPrvThumbShift(cpu, 0, regs[vD], t);
+						break;
+					
+					case 3:			// LSR(2)
+						regs[vD] = cpuPrvThumbShift(cpu, 1, regs[vD], t);
+						break;
+					
+					case 4:			// ASR(2)
+						regs[vD] = cpuPrvThumbShift(cpu, 2, regs[vD], t);
+						break;
+					
+					case 5:			// ADC
+						regs[vD] = cpuPrvFlagsAdd(cpu, regs[vD], t, cpuPrvFlagC(cpu));
+						break;
+					
+					case 6:			// SBC
+						regs[vD] = cpuPrvFlagsAdd(cpu, regs[vD], ~t, cpuPrvFlagC(cpu));
+						break;
+					
+					case 7:			// ROR
+						regs[vD] = cpuPrvThumbShift(cpu, 3, regs[vD], t);
+						break;
+					
+					case 8:			// TST
+						cpuPrvFlagsNZ(cpu, regs[vD] & t);
+						break;
+					
+					case 9:			// NEG
+						regs[vD] = cpuPrvFlagsAdd(cpu, 0, ~t, true);
+						break;
+					
+					case 10:		// CMP(2)
+						cpuPrvFlagsAdd(cpu, regs[vD], ~t, true);
+						break;
+					
+					case 11:		// CMN
+						cpuPrvFlagsAdd(cpu, regs[vD], t, false);
+						break;
+					
+					case 12:		// ORR
+						regs[vD] |= t;
+						cpuPrvFlagsNZ(cpu, regs[vD]);
+						break;
+					
+					case 13:		// MUL
+						regs[vD] *= t;
+						cpuPrvFlagsNZ(cpu, regs[vD]);
+						break;
+					
+					case 14:		// BIC
+						regs[vD] &=~ t;
+						cpuPrvFlagsNZ(cpu, regs[vD]);
+						break;
+					
+					case 15:		// MVN
+						regs[vD] = ~t;
+						cpuPrvFlagsNZ(cpu, regs[vD]);
+						break;
+				}
+			}
+			break;
+		
+		case 5:		// STR(2)  STRH(2) STRB(2) LDRSB LDR(2) LDRH(2) LDRB(2) LDRSH		(in sizes order)
+			
+			v8 = (instrT >> 9) & 7;
+			t = regs[(instrT >> 3) & 7] + regs[(instrT >> 6) & 7];
+			
+			if(v8 < 3) cpuPrvThumbStore(cpu, regs[instrT & 7], t, sizes[v8], privileged);
+			else cpuPrvThumbLoad(cpu, instrT & 7, t, sizes[v8], v8 == 3 || v8 == 7, privileged);
+			break;
+		
+		case 6:		// LDR(1) STR(1)	(bit11 set = ldr)
+			
+			t = regs[(instrT >> 3) & 7] + ((instrT >> 4) & 0x7C);
+			if(instrT & 0x0800) cpuPrvThumbLoad(cpu, instrT & 7, t, 4, false, privileged);
+			else cpuPrvThumbStore(cpu, regs[instrT & 7], t, 4, privileged);
+			break;
+		
+		case 7:		// LDRB(1) STRB(1)	(bit11 set = ldrb)
+			
+			t = regs[(instrT >> 3) & 7] + ((instrT >> 6) & 0x1F);
+			if(instrT & 0x0800) cpuPrvThumbLoad(cpu, instrT & 7, t, 1, false, privileged);
+			else cpuPrvThumbStore(cpu, regs[instrT & 7], t, 1, privileged);
+			break;
+		
+		case 8:		// LDRH(1) STRH(1)	(bit11 set = ldrh)
+			
+			t = regs[(instrT >> 3) & 7] + ((instrT >> 5) & 0x3E);
+			if(instrT & 0x0800) cpuPrvThumbLoad(cpu, instrT & 7, t, 2, false, privileged);
+			else cpuPrvThumbStore(cpu, regs[instrT & 7], t, 2, privileged);
+			break;
+		
+		case 9:		// LDR(4) STR(3)	(bit11 set = ldr)
+			
+			t = regs[13] + ((instrT & 0xFF) << 2);
+			if(instrT & 0x0800) cpuPrvThumbLoad(cpu, (instrT >> 8) & 7, t, 4, false, privileged);
+			else cpuPrvThumbStore(cpu, regs[(instrT >> 8) & 7], t, 4, privileged);
+			break;
+		
+		case 10:	// ADD(5) ADD(6)	(bit11 set = add(6))
+			
+			t = (instrT & 0x0800) ? regs[13] : ((pc + 4) &~ 3UL);
+			regs[(instrT >> 8) & 7] = t + ((instrT & 0xFF) << 2);
+			break;
+		
+		case 11:	// ADD(7) SUB(4) PUSH POP, the rest is rare enough to go via ARM
+			
+			if((instrT & 0x0600) == 0x0400){		//PUSH POP
+				
+				v16 = instrT & 0xFF;
+				
+				if(instrT & 0x0800){			//POP
+					
+					if(instrT & 0x0100) v16 |= 0x8000U;
+					cpuPrvThumbLoadStoreMultiple(cpu, 13, v16, true, true, true, privileged);
+				}
+				else{					//PUSH
+					
+					if(instrT & 0x0100) v16 |= 0x4000U;
+					cpuPrvThumbLoadStoreMultiple(cpu, 13, v16, false, false, true, privileged);
+				}
+			}
+			else if((instrT & 0x0F00) == 0){		// ADD(7) SUB(4)
+				
+				t = (instrT & 0x7F) << 2;
+				if(instrT & 0x0080) regs[13] -= t;
+				else regs[13] += t;
+			}
+			else goto convert;
+			break;
+		
+		case 12:	// LDMIA STMIA		(bit11 set = ldmia)
+			
+			v8 = (instrT >> 8) & 7;
+			cpuPrvThumbLoadStoreMultiple(cpu, v8, instrT & 0xFF, (instrT & 0x0800) != 0, true, !((1UL << v8) & instrT), privileged);
+			break;
+		
+		case 13:	// B(1), SWI, undefined instr space
+			
+			v8 = (instrT >> 8) & 0x0F;
+			if(v8 >= 14) goto convert;
+			
+			if(cpuPrvCondPasses(cpu, v8)){
+				
+				t = instrT & 0xFF;
+				if(t & 0x80) t |= 0xFFFFFF00UL;
+				regs[15] = pc + 4 + (t << 1);
+			}
+			break;
+		
+		case 14:	// B(2) BL BLX(1) undefined instr space
+		case 15:
+			
+			v16 = (instrT & 0x7FF);
+			switch((instrT >> 11) & 3){
+				
+				case 0:		//B(2)
+					t = v16;
+					if(instrT & 0x0400) t |= 0xFFFFF800UL;
+					regs[15] = pc + 4 + (t << 1);
+					break;
+				
+				case 1:		//BLX(1)_suffix
+					instr = regs[15];
+					regs[15] = (regs[14] + 2 + (((UInt32)v16) << 1)) &~ 3UL;
+					regs[14] = instr | 1UL;
+					cpu->CPSR &=~ ARM_SR_T;
+					break;
+				
+				case 2:		//BLX(1)_prefix BL_prefix
+					instr = v16;
+					if(instrT & 0x0400) instr |= 0x000FF800UL;
+					regs[14] = regs[15] + (instr << 12);
+					break;
+				
+				case 3:		//BL_suffix
+					instr = regs[15];
+					regs[15] = regs[14] + 2 + (((UInt32)v16) << 1);
+					regs[14] = instr | 1UL;
+					break;
+			}
+			break;
+	}
+	
+	return errNone;
+	
+convert:	//never false for what gets here
+	cpuPrvThumbToArm(instrT, &instr, &specialPC);
+	return cpuPrvExecInstr(cpu, instr, pc, true, privileged, specialPC);
+}
+
+#ifdef OPCACHE
+
+	#define OP_CARRY_KEEP	0	//op->mode for data processing: how to get the shifter carry out
+	#define OP_CARRY_CLEAR	1
+	#define OP_CARRY_SET	2
+	#define OP_SHIFTER	3	//operand is not a constant, run the shifter
+	
+	static Err cpuPrvOpExec(ArmCpu* cpu, const opcacheOp* op, UInt32 pc, Boolean privileged){	//all the instrs we have no special handler for
+		
+		return cpuPrvExecInstr(cpu, op->instr, pc, false, privileged, false);
+	}
+	
+	static Err cpuPrvOpExecThumb(ArmCpu* cpu, const opcacheOp* op, UInt32 pc, Boolean privileged){	//all thumb instrs
+		
+		return cpuPrvExecThumb(cpu, op->instr, pc, privileged);
+	}
+	
+	static Err cpuPrvOpDataProc(ArmCpu* cpu, const opcacheOp* op, UInt32 pc, Boolean privileged){
+		
+		Boolean carryOut;
+		UInt32 val = op->imm;
+		UInt8 mode;
+		
+		if(!cpuPrvCondPasses(cpu, op->instr >> 28)) return errNone;
+		
+		switch(op->mode){
+			
+			case OP_CARRY_KEEP:
+				carryOut = cpuPrvFlagC(cpu);
+				break;
+			
+			case OP_CARRY_CLEAR:
+				carryOut = false;
+				break;
+			
+			case OP_CARRY_SET:
+				carryOut = true;
+				break;
+			
+			default:
+				val = cpuPrvArmAdrMode_1(cpu, op->instr, &carryOut, false, false);
+				break;
+		}
+		
+		mode = cpu->CPSR & ARM_SR_M;
+		if(!cpuPrvDataProc(cpu, op->instr, val, carryOut, mode == ARM_SR_MODE_USR || mode == ARM_SR_MODE_SYS, false, false)) return cpuPrvOpExec(cpu, op, pc, privileged);
+		
+		return errNone;
+	}
+	
+	static Err cpuPrvOpLoadStore(ArmCpu* cpu, const opcacheOp* op, _UNUSED_ UInt32 pc, Boolean privileged){	//immediate offset LDR/STR/LDRB/STRB
+		
+		if(cpuPrvCondPasses(cpu, op->instr >> 28)) cpuPrvLoadStoreMode_2(cpu, op->instr, op->mode, op->imm, op->imm2, privileged, false, false);
+		
+		return errNone;
+	}
+	
+	static Err cpuPrvOpBranch(ArmCpu* cpu, const opcacheOp* op, UInt32 pc, _UNUSED_ Boolean privileged){	//B/BL
+		
+		if(cpuPrvCondPasses(cpu, op->instr >> 28)){
+			
+			if(op->instr & 0x01000000UL) cpu->regs[14] = pc + 4;
+			cpuPrvSetPC(cpu, op->imm);
+		}
+		
+		return errNone;
+	}
+	
+	static void cpuPrvOpDecode(ArmCpu* cpu, opcacheOp* op, UInt32 instr, UInt32 va, UInt8 flags){	//work out all we can from the instr bits alone
+		
+		UInt32 v;
+		
+		op->va = va;
+		op->instr = instr;
+		op->flags = flags | OPCACHE_VALID;
+		op->exec = cpuPrvOpExec;
+		
+		if((instr >> 28) == 0x0F) return;		//unconditional instrs are rare, let cpuPrvExecInstr() have them
+		
+		switch((instr >> 25) & 7){
+			
+			case 0:		//data processing with shifts
+				if((instr & 0x00000090UL) == 0x00000090UL || (instr & 0x01900000UL) == 0x01000000UL) break;
+				op->mode = OP_SHIFTER;
+				op->exec = cpuPrvOpDataProc;
+				break;
+			
+			case 1:		//data processing immediate
+				if((instr & 0x01900000UL) == 0x01000000UL) break;
+				v = (instr >> 7) & 0x1E;
+				op->imm = cpuPrvROR(instr & 0xFF, v);
+				if(!v) op->mode = OP_CARRY_KEEP;
+				else op->mode = (op->imm & 0x80000000UL) ? OP_CARRY_SET : OP_CARRY_CLEAR;
+				op->exec = cpuPrvOpDataProc;
+				break;
+			
+			case 2:		//load/store immediate offset
+				op->mode = cpuPrvArmAdrMode_2(cpu, instr, &op->imm, &op->imm2, false, false);
+				if(op->mode & ARM_MODE_2_T) break;
+				op->exec = cpuPrvOpLoadStore;
+				break;
+			
+			case 5:		//B/BL
+				v = instr & 0x00FFFFFFUL;
+				if(v & 0x00800000UL) v |= 0xFF000000UL;
+				v = (v << 2) + va + 8;
+				op->imm = v;
+				op->exec = cpuPrvOpBranch;
+				break;
+		}
+	}
+	
+	static void cpuPrvOpDecodeThumb(_UNUSED_ ArmCpu* cpu, opcacheOp* op, UInt16 instrT, UInt32 va, UInt8 flags){	//thumb instrs are cheap to decode natively, we just save the fetch
+		
+		op->va = va;
+		op->instr = instrT;
+		op->flags = flags | OPCACHE_THUMB | OPCACHE_VALID;
+		op->exec = cpuPrvOpExecThumb;
+	}
+
+#endif
+
+#ifndef THREADED_CORE	//the threaded core has its own fetch and dispatch
+
+static Err cpuPrvCycleArm(ArmCpu* cpu){
+	
+	Boolean privileged, ok;
+	UInt32 instr, pc;
+	UInt8 fsr;
+#ifdef OPCACHE
+	opcacheOp* op;
+#endif
+
+	privileged = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
+	pc = cpu->regs[15];
+	
+#ifdef OPCACHE
+	op = opcacheSlot(&cpu->oc, pc);
+	if(opcacheHit(op, pc, privileged ? OPCACHE_PRIV : 0)){
+		
+		cpu->regs[15] += 4;
+		return op->exec(cpu, op, pc, privileged);
+	}
+#endif
+
+	//fetch instruction
+	{
+		ok = icacheFetch(&cpu->ic, pc, 4, privileged, &fsr, &instr);
+		if(!ok){
+			cpuPrvHandleMemErr(cpu, pc, 4, false, true, fsr);
+			return errNone;						//exit here so that debugger can see us execute first instr of execption handler
+		}
+		cpu->regs[15] += 4;
+	}
+	
+#ifdef OPCACHE
+	cpuPrvOpDecode(cpu, op, instr, pc, privileged ? OPCACHE_PRIV : 0);
+	return op->exec(cpu, op, pc, privileged);
+#else
+	return cpuPrvExecInstr(cpu, instr, pc, false, privileged, false);
+#endif
+}
+
+static Err cpuPrvCycleThumb(ArmCpu* cpu){
+	
+	Boolean privileged, ok;
+	UInt32 pc;
+	UInt16 instrT;
+	UInt8 fsr;
+#ifdef OPCACHE
+	opcacheOp* op;
+#endif
+
+	privileged = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
+	
+	pc = cpu->regs[15];
+	
+#ifdef OPCACHE
+	op = opcacheSlot(&cpu->oc, pc);
+	if(opcacheHit(op, pc, OPCACHE_THUMB | (privileged ? OPCACHE_PRIV : 0))){
+		
+		cpu->regs[15] += 2;
+		return op->exec(cpu, op, pc, privileged);
+	}
+#endif
+
+	ok = icacheFetch(&cpu->ic, pc, 2, privileged, &fsr, &instrT);
+	if(!ok){
+		cpuPrvHandleMemErr(cpu, pc, 2, false, true, fsr);
+		return errNone;						//exit here so that debugger can see us execute first instr of execption handler
+	}
+	cpu->regs[15] += 2;
+	
+#ifdef OPCACHE
+	cpuPrvOpDecodeThumb(cpu, op, instrT, pc, privileged ? OPCACHE_PRIV : 0);
+	return op->exec(cpu, op, pc, privileged);
+#else
+	return cpuPrvExecThumb(cpu, instrT, pc, privileged);
+#endif
+}
+
+#endif
+
+
+#ifdef THREADED_CORE
+
+	#ifndef __GNUC__
+		#error "the threaded core needs gcc's labels as values"
+	#endif
+
+	/*
+		every handler ends in its own copy of the fetch & dispatch code, so the host's branch predictor keeps a separate
+		history of what follows each class of instr, instead of all of them sharing one hopeless indirect jump. the
+		handlers themselves are the same helpers cpuPrvExecInstr() uses, so both cores behave the same. there is no
+		opcache here (CPU.h turns it off): its decoded ops all run through one op->exec call, which is exactly the
+		shared indirect jump this core exists to avoid
+	*/
+	
+	#define THREADED_DISPATCH()													\
+		do{															\
+			if(n == max || cpu->attention){											\
+				cpu->runDone = n;											\
+				return;													\
+			}														\
+			cpu->runDone = n++;												\
+			pc = cpu->regs[15];												\
+			privileged = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;								\
+			if(cpu->CPSR & ARM_SR_T){											\
+				if(!icacheFetch(&cpu->ic, pc, 2, privileged, &fsr, &instrT)){						\
+					cpuPrvHandleMemErr(cpu, pc, 2, false, true, fsr);						\
+					goto next;											\
+				}													\
+				cpu->regs[15] += 2;											\
+				goto op_thumb;												\
+			}														\
+			else{														\
+				if(!icacheFetch(&cpu->ic, pc, 4, privileged, &fsr, &instr)){						\
+					cpuPrvHandleMemErr(cpu, pc, 4, false, true, fsr);						\
+					goto next;											\
+				}													\
+				cpu->regs[15] += 4;											\
+			}														\
+			if((instr >> 28) == 0x0F) goto op_other;									\
+			if(!cpuPrvCondPasses(cpu, instr >> 28)) goto next;								\
+			goto *classes[(instr >> 25) & 7];										\
+		}while(0)
+	
+	static void cpuPrvRunThreaded(ArmCpu* cpu, UInt32 max){	//runs till cpu->runDone reaches max or attention
+		
+		static const void* const classes[8] = {&&op_dp_reg, &&op_dp_imm, &&op_ls_imm, &&op_ls_reg, &&op_other, &&op_branch, &&op_other, &&op_other};
+		Boolean privileged = false, carryOut;
+		UInt32 instr = 0, pc = 0, n = cpu->runDone, val, m32, x32;
+		UInt16 instrT = 0;
+		UInt8 fsr, mode;
+		
+	next:
+		THREADED_DISPATCH();
+	
+	op_dp_reg:	//data processing with shifts, but also multiplies, extra load/stores and misc instrs
+		if((instr & 0x00000090UL) == 0x00000090UL) goto op_other;
+		//fallthrough
+	
+	op_dp_imm:
+		if((instr & 0x01900000UL) == 0x01000000UL) goto op_other;
+		
+		val = cpuPrvArmAdrMode_1(cpu, instr, &carryOut, false, false);
+		mode = cpu->CPSR & ARM_SR_M;
+		if(!cpuPrvDataProc(cpu, instr, val, carryOut, mode == ARM_SR_MODE_USR || mode == ARM_SR_MODE_SYS, false, false)) goto op_other;
+		THREADED_DISPATCH();
+	
+	op_ls_reg:
+		if(instr & 0x00000010UL) goto op_other;	//media and undefined instrs
+		//fallthrough
+	
+	op_ls_imm:
+		mode = cpuPrvArmAdrMode_2(cpu, instr, &m32, &x32, false, false);
+		cpuPrvLoadStoreMode_2(cpu, instr, mode, m32, x32, privileged && !(mode & ARM_MODE_2_T), false, false);
+		THREADED_DISPATCH();
+	
+	op_branch:	//B/BL
+		val = instr & 0x00FFFFFFUL;
+		if(val & 0x00800000UL) val |= 0xFF000000UL;
+		val = (val << 2) + pc + 8;
+		if(instr & 0x01000000UL) cpu->regs[14] = pc + 4;
+		cpuPrvSetPC(cpu, val);
+		THREADED_DISPATCH();
+	
+	op_thumb:
+		cpuPrvExecThumb(cpu, instrT, pc, privileged);
+		THREADED_DISPATCH();
+	
+	op_other:	//everything else
+		cpuPrvExecInstr(cpu, instr, pc, false, privileged, false);
+		THREADED_DISPATCH();
+	}
+
+#endif
+
+Err cpuInit(ArmCpu* cpu, UInt32 pc, ArmCpuMemF memF, ArmCpuEmulErr emulErrF, ArmCpuHypercall hypercallF, ArmSetFaultAdrF setFaultAdrF){
+	
+	if(!TYPE_CHECK){
+		emulErrF(cpu, "Type size error! CPU init aborted");
+		return errInternal;
+	}
+
+	__mem_zero(cpu, sizeof(ArmCpu));
+	
+	cpu->CPSR = ARM_SR_I | ARM_SR_F | ARM_SR_MODE_SVC;	//start w/o interrupts in supervisor mode
+	cpuPrvSetPC(cpu, pc);
+
+	cpu->memF = memF;
+	cpu->emulErrF = emulErrF;
+	cpu->hypercallF = hypercallF;
+	cpu->setFaultAdrF = setFaultAdrF;
+
+	icacheInit(&cpu->ic, cpu, memF);
+#ifdef OPCACHE
+	opcacheInit(&cpu->oc);
+#endif
+	
+#ifdef DYNAREC
+	if(!dynarecInit(&cpu->jit, cpu)){
+		emulErrF(cpu, "Cannot allocate dynarec memory! CPU init aborted");
+		return errInternal;
+	}
+#endif
+
+	return errNone;
+}
+
+Err cpuDeinit(_UNUSED_ ArmCpu* cpu){
+
+#ifdef DYNAREC
+	dynarecDeinit(&cpu->jit);
+#endif
+
+	return errNone;
+}
+
+#ifndef THREADED_CORE
+
+	static void cpuPrvRunArm(ArmCpu* cpu, UInt32 max){	//runs till cpu->runDone reaches max, a switch to thumb or attention
+		
+		UInt32 n = cpu->runDone;
+		
+		do{
+			cpuPrvCycleArm(cpu);
+			cpu->runDone = ++n;
+		}while(n < max && !cpu->attention && !(cpu->CPSR & ARM_SR_T));
+	}
+	
+	static void cpuPrvRunThumb(ArmCpu* cpu, UInt32 max){	//runs till cpu->runDone reaches max, a switch to arm or attention
+		
+		UInt32 n = cpu->runDone;
+		
+		do{
+			cpuPrvCycleThumb(cpu);
+			cpu->runDone = ++n;
+		}while(n < max && !cpu->attention && (cpu->CPSR & ARM_SR_T));
+	}
+
+#endif
+
+/*
+	interrupts are only looked at on the way in, so anything that could make one deliverable (cpuIrq(), a CPSR write,
+	a device wanting the world to stop) raises attention, which gets us out after the current instr. the caller then
+	ticks its devices and calls us again. the count of instrs retired so far lives in cpu->runDone, so a device being
+	accessed mid-run can work out exactly what time it is
+*/
+
+UInt32 cpuRun(ArmCpu* cpu, UInt32 budget){
+
+	UInt32 vector, newCPSR, n, max;
+#ifdef DYNAREC
+	UInt32 m;
+#endif
+
+	cpu->attention = false;
+	cpu->runDone = 0;
+	
+	if(cpu->sleeping){
+		
+		if(!cpu->waitingFiqs && !cpu->waitingIrqs) return 0;
+		cpu->sleeping = false;
+	}
+
+	if(cpu->waitingFiqs && !(cpu->CPSR & ARM_SR_F)){
+		
+		cpuPrvFlagsSync(cpu);
+		newCPSR = ARM_CPSR_FIQ_ORR | (cpu->CPSR & ARM_CPSR_FIQ_AND);
+		vector = cpu->vectorBase + ARM_VECTOR_OFFT_FIQ;
+	}
+	else if(cpu->waitingIrqs && !(cpu->CPSR & ARM_SR_I)){
+		
+		cpuPrvFlagsSync(cpu);
+		newCPSR = ARM_CPSR_IRQ_ORR | (cpu->CPSR & ARM_CPSR_IRQ_AND);
+		vector = cpu->vectorBase + ARM_VECTOR_OFFT_IRQ;
+	}
+#ifdef ARM_V6
+	else if(cpu->impreciseAbtWaiting && !(cpu->CPSR & ARM_SR_A)){
+		
+		cpuPrvFlagsSync(cpu);
+		newCPSR = ARM_CPSR_DAB_ORR | (cpu->CPSR & ARM_CPSR_DAB_AND);
+		vector = cpu->vectorBase + ARM_VECTOR_OFFT_D_ABT;
+	}
+#endif
+	else{
+		goto normal;
+	}
+
+	cpuPrvException(cpu, vector, cpu->regs[15] + 4, newCPSR);
+
+normal:
+
+	while(cpu->runDone < budget && !cpu->attention){
+		
+	#ifdef DYNAREC
+		cpuPrvFlagsSync(cpu);		//translated code keeps NZCV in CPSR
+		m = dynarecRun(&cpu->jit);
+		if(m){
+			
+			cpu->runDone += m;
+			continue;
+		}
+		max = cpu->runDone + 1;		//the dynarec wants control back after every instr
+	#else
+		max = budget;
+	#endif
+	
+	#ifdef THREADED_CORE
+		cpuPrvRunThreaded(cpu, max);
+	#else
+		if(cpu->CPSR & ARM_SR_T){
+			cpuPrvRunThumb(cpu, max);
+		}
+		else{
+			
+			cpuPrvRunArm(cpu, max);
+		}
+	#endif
+	}
+	
+	n = cpu->runDone;
+	cpu->runDone = 0;
+	
+	return n;
+}
+
+void cpuIrq(ArmCpu* cpu, Boolean fiq, Boolean raise){	//unraise when acknowledged
+
+	if(fiq){
+		if(raise){
+			cpu->waitingFiqs++;
+			cpu->attention = true;
+		}
+		else if(cpu->waitingFiqs){
+			cpu->waitingFiqs--;
+		}
+		else{
+			cpu->emulErrF(cpu,"Cannot unraise FIQ when none raised");
+		}
+	}
+	else{
+		if(raise){
+			cpu->waitingIrqs++;
+			cpu->attention = true;
+		}
+		else if(cpu->waitingIrqs){
+			cpu->waitingIrqs--;
+		}
+		else{
+			cpu->emulErrF(cpu,"Cannot unraise IRQ when none raised");
+		}
+	}
+}
+
+void cpuAttention(ArmCpu* cpu){
+	
+	cpu->attention = true;
+}
+
+UInt32 cpuRunElapsed(ArmCpu* cpu){
+	
+	return cpu->runDone;
+}
+
+void cpuSleep(ArmCpu* cpu){
+	
+	cpu->sleeping = true;
+	cpu->attention = true;
+}
+
+Boolean cpuIsSleeping(ArmCpu* cpu){
+	
+	return cpu->sleeping;
+}
+
+void cpuSnap(ArmCpu* cpu, Snap* s){
+	
+	cpuPrvFlagsSync(cpu);		//the lazy flags are not part of the format, NZCV go in CPSR
+	
+	snapVal(s, cpu->regs);
+	snapVal(s, cpu->CPSR);
+	snapVal(s, cpu->SPSR);
+	snapVal(s, cpu->bank_usr);
+	snapVal(s, cpu->bank_svc);
+	snapVal(s, cpu->bank_abt);
+	snapVal(s, cpu->bank_und);
+	snapVal(s, cpu->bank_irq);
+	snapVal(s, cpu->bank_fiq);
+	snapVal(s, cpu->extra_regs);
+	snapVal(s, cpu->waitingIrqs);
+	snapVal(s, cpu->waitingFiqs);
+	snapVal(s, cpu->CPAR);
+	snapVal(s, cpu->sleeping);
+	snapVal(s, cpu->vectorBase);
+#ifdef ARM_V6
+	snapVal(s, cpu->EEE);
+	snapVal(s, cpu->impreciseAbtWaiting);
+#endif
+	
+	if(!s->load) return;
+	
+	cpu->flagsOp = ARM_FLAGS_SYNCED;
+	cpu->attention = true;		//irqs may be waiting
+	cpuIcacheInval(cpu);		//RAM gets replaced too, whatever we translated is stale
+}
+
+void cpuIcacheInval(ArmCpu* cpu){
+
+	icacheInval(&cpu->ic);
+#ifdef OPCACHE
+	opcacheInval(&cpu->oc);
+#endif
+#ifdef DYNAREC
+	dynarecInval(&cpu->jit);
+#endif
+}
+
+void cpuIcacheInvalAddr(ArmCpu* cpu, UInt32 addr){
+
+	icacheInvalAddr(&cpu->ic, addr);
+#ifdef OPCACHE
+	opcacheInvalAddr(&cpu->oc, addr);
+#endif
+#ifdef DYNAREC
+	dynarecInvalAddr(&cpu->jit, addr);
+#endif
+}
+
+
+void cpuCoprocessorRegister(ArmCpu* cpu, UInt8 cpNum, ArmCoprocessor* coproc){
+
+	cpu->coproc[cpNum] = *coproc;
+}
+
+void cpuCoprocessorUnregister(ArmCpu* cpu, UInt8 cpNum){
+
+	ArmCoprocessor cp;
+
+	__mem_zero(&cp, sizeof(ArmCoprocessor));
+
+	cpu->coproc[cpNum] = cp;	
+}
+
+void cpuSetVectorAddr(ArmCpu* cpu, UInt32 adr){
+	
+	cpu->vectorBase = adr;	
+}
+
+UInt16 cpuGetCPAR(ArmCpu* cpu){
+	
+	return cpu->CPAR;	
+}
+
+void cpuSetCPAR(ArmCpu* cpu, UInt16 cpar){
+
+	cpu->CPAR = cpar;	
+}
+
+#ifdef ARM_V6
+
+	void cpuSignalImpreciseAbt(ArmCpu* cpu, Boolean raise){
+		
+		cpu->impreciseAbtWaiting = raise;
+		if(raise) cpu->attention = true;
+	}
+
+
+#endif
+
+#ifdef DYNAREC
+
+	void cpuDynarecExecArm(ArmCpu* cpu, UInt32 instr, UInt32 instrPC){
+		
+		cpu->regs[15] = instrPC + 4;
+		cpuPrvExecInstr(cpu, instr, instrPC, false, (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR, false);
+		cpuPrvFlagsSync(cpu);
+	}
+	
+	void cpuDynarecExecThumb(ArmCpu* cpu, UInt16 instrT, UInt32 instrPC){
+		
+		cpu->regs[15] = instrPC + 2;
+		cpuPrvExecThumb(cpu, instrT, instrPC, (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR);
+		cpuPrvFlagsSync(cpu);
+	}
+	
+	Boolean cpuDynarecThumbToArm(UInt16 instrT, UInt32* instrP, Boolean* specialPCP){
+		
+		return cpuPrvThumbToArm(instrT, instrP, specialPCP);
+	}
+	
+	void cpuDynarecDataAbort(ArmCpu* cpu, UInt32 addr, UInt8 sz, Boolean write, UInt8 fsr){
+		
+		cpuPrvHandleMemErr(cpu, addr, sz, write, false, fsr);
+	}
+
+#endif
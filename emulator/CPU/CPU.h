@@ -4,8 +4,16 @@
 
 //#define ARM_V6		//define to allow v6 instructions
 //#define THUMB_2			//define to allow Thumb2
+//#define DYNAREC		//define to translate guest code into x86-64 host code (x86-64 hosts only)
+#define OPCACHE			//define to cache decoded instrs instead of decoding them on every execution
+//#define THREADED_CORE		//define to use the computed-goto dispatch core instead of cpuPrvCycleArm()/cpuPrvCycleThumb() (gcc only)
+
+#ifdef THREADED_CORE	//it dispatches on the raw instr's class, decoded ops would all go back through one indirect call
+	#undef OPCACHE
+#endif
 
 #include "../helper/types.h"
+#include "../helper/snap.h"
 
 struct ArmCpu;
 
@@ -68,6 +76,11 @@ typedef void	(*ArmCpuEmulErr)	(struct ArmCpu* cpu, const char* err_str);
 typedef void	(*ArmSetFaultAdrF)	(struct ArmCpu* cpu, UInt32 adr, UInt8 faultStatus);
 
 #include "../cache/icache.h"
+#include "../cache/opcache.h"
+
+#ifdef DYNAREC
+	#include "../dynarec/dynarec.h"
+#endif
 
 
 /*
@@ -109,6 +122,9 @@ typedef struct ArmCpu{
 	UInt32		regs[16];		//current active regs as per current mode
 	UInt32		CPSR, SPSR;
 
+	UInt32		flagsRes, flagsV;		//lazily evaluated flags, NZCV in CPSR are stale unless flagsOp says otherwise
+	UInt8		flagsOp, flagsC;
+
 	ArmBankedRegs	bank_usr;		//usr regs when in another mode
 	ArmBankedRegs	bank_svc;		//svc regs when in another mode
 	ArmBankedRegs	bank_abt;		//abt regs when in another mode
@@ -120,6 +136,9 @@ typedef struct ArmCpu{
 	UInt16		waitingIrqs;
 	UInt16		waitingFiqs;
 	UInt16		CPAR;
+	Boolean		attention;		//cpuRun() comes back out after the current instr when set
+	UInt32		runDone;		//instrs retired so far by the current cpuRun(), 0 outside of it
+	Boolean		sleeping;		//waiting for an interrupt, cpuRun() runs nothing till one is raised
 
 	ArmCoprocessor	coproc[16];		//coprocessors
 
@@ -138,6 +157,12 @@ typedef struct ArmCpu{
 	ArmSetFaultAdrF	setFaultAdrF;
 	
 	icache		ic;
+#ifdef OPCACHE
+	opcache		oc;
+#endif
+#ifdef DYNAREC
+	Dynarec		jit;
+#endif
 
 	void*		userData;		//shared by all callbacks
 }ArmCpu;
@@ -145,8 +170,12 @@ typedef struct ArmCpu{
 
 Err cpuInit(ArmCpu* cpu, UInt32 pc, ArmCpuMemF memF, ArmCpuEmulErr emulErrF, ArmCpuHypercall hypercallF, ArmSetFaultAdrF setFaultAdrF);
 Err cpuDeinit(ArmCpu* cp);
-void cpuCycle(ArmCpu* cpu);
+UInt32 cpuRun(ArmCpu* cpu, UInt32 budget);		//runs about budget instrs, less if attention gets raised. returns number of instrs executed
 void cpuIrq(ArmCpu* cpu, Boolean fiq, Boolean raise);	//unraise when acknowledged
+void cpuAttention(ArmCpu* cpu);				//for devices that need cpuRun() to return as soon as possible
+UInt32 cpuRunElapsed(ArmCpu* cpu);			//instrs retired by the cpuRun() we are in, for devices that need the exact time mid-run
+void cpuSleep(ArmCpu* cpu);				//stop running instrs till an irq or fiq is raised, masked in CPSR or not
+Boolean cpuIsSleeping(ArmCpu* cpu);
 
 #ifdef ARM_V6
 
@@ -168,6 +197,19 @@ void cpuSetCPAR(ArmCpu* cpu, UInt16 cpar);
 void cpuIcacheInval(ArmCpu* cpu);
 void cpuIcacheInvalAddr(ArmCpu* cpu, UInt32 addr);
 
+void cpuSnap(ArmCpu* cpu, Snap* s);			//save/restore regs & modes. not between instrs of a cpuRun(), and coprocessors are not ours to do
+
+#ifdef DYNAREC
+
+	//for translated code to hand the rare instrs over to the interpreter. PC is set up as the interpreter expects
+	void cpuDynarecExecArm(ArmCpu* cpu, UInt32 instr, UInt32 instrPC);
+	void cpuDynarecExecThumb(ArmCpu* cpu, UInt16 instrT, UInt32 instrPC);
+	
+	Boolean cpuDynarecThumbToArm(UInt16 instrT, UInt32* instrP, Boolean* specialPCP);	//false if instr needs cpuDynarecExecThumb()
+	void cpuDynarecDataAbort(ArmCpu* cpu, UInt32 addr, UInt8 sz, Boolean write, UInt8 fsr);	//regs[15] must be as the interpreter would have it
+	
+#endif
+
 
 #endif
 
@@ -113,7 +113,12 @@ static Boolean cp15prvCoprocRegXferFunc(struct ArmCpu* cpu, void* userData, Bool
 			goto success;
 		
 		case 8:		//TLB ops
-			mmuTlbFlush(cp15->mmu);
+			if(CRm == 5) tmp = MMU_TLB_I;
+			else if(CRm == 6) tmp = MMU_TLB_D;
+			else tmp = MMU_TLB_I | MMU_TLB_D;
+			
+			if(op2 == 1) mmuTlbInvalAddr(cp15->mmu, val, tmp);	//single entry, given MVA
+			else mmuTlbInval(cp15->mmu, tmp);
 			goto success;
 		
 		case 9:		//cache lockdown
@@ -173,6 +178,28 @@ void cp15Init(ArmCP15* cp15, ArmCpu* cpu, ArmMmu* mmu){
 	cpuCoprocessorRegister(cpu, 15, &cp);
 }
 
+void cp15Snap(ArmCP15* cp15, Snap* s){
+	
+	UInt32 domains = mmuGetDomainCfg(cp15->mmu);
+	
+	snapVal(s, cp15->control);
+	snapVal(s, cp15->ttb);
+	snapVal(s, cp15->FSR);
+	snapVal(s, cp15->FAR);
+	snapVal(s, cp15->CPAR);
+	snapVal(s, cp15->ACP);
+	snapVal(s, domains);
+	
+	if(!s->load) return;
+	
+	mmuSetTTP(cp15->mmu, (cp15->control & 0x00000001UL) ? cp15->ttb : MMU_DISABLED_TTP);
+	mmuSetR(cp15->mmu, (cp15->control & 0x00000200UL) != 0);
+	mmuSetS(cp15->mmu, (cp15->control & 0x00000100UL) != 0);
+	mmuSetDomainCfg(cp15->mmu, domains);
+	mmuTlbFlush(cp15->mmu);
+	cpuSetVectorAddr(cp15->cpu, (cp15->control & 0x00002000UL) ? 0xFFFF0000UL : 0x00000000UL);
+}
+
 void cp15Deinit(ArmCP15* cp15){
 	
 	cpuCoprocessorUnregister(cp15->cpu, 15);
@@ -22,6 +22,7 @@ typedef struct{
 void cp15Init(ArmCP15* cp15, ArmCpu* cpu, ArmMmu* mmu);
 void cp15Deinit(ArmCP15* cp15);
 void cp15SetFaultStatus(ArmCP15* cp15, UInt32 addr, UInt8 faultStatus);
+void cp15Snap(ArmCP15* cp15, Snap* s);	//mmu state is all derived from ours, a restore sets it up again
 
 #endif
 
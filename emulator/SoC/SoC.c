@@ -14,6 +14,7 @@
 #include "../pxa255/GPIO/pxa255_GPIO.h"
 #include "../pxa255/DMA/pxa255_DMA.h"
 #include "../pxa255/DSP/pxa255_DSP.h"
+#include "../sched/sched.h"
 
 #include "../helper/print.h"
 #include "../helper/external.h"
@@ -34,10 +35,45 @@ static const UInt8 embedded_boot[] =	{
 #define RAM_SIZE	0x01000000UL	//16M @ 0xA0000000
 
 
+#define SOC_POLL_MAX_LOOP	32		//instrs, longest polling loop we recognize
+#define SOC_POLL_NONE		0xFFFFFFFFUL
+
+/*
+	a guest spinning on a device register does the same thing each time round: same instr, same register, same value
+	read, all cpu regs the same as last time. nothing it does can change anything, so only a device event can get it
+	out of there. when we see that, we skip time ahead to the next scheduler deadline instead of running the loop
+*/
+
+static void socPrvNoteDevRead(SoC* soc, UInt32 pa, UInt32 val){
+	
+	ArmCpu* cpu = &soc->cpu;
+	UInt64 now = schedTime(&soc->sched);
+	Boolean same;
+	UInt8 i;
+	
+	same = pa == soc->poll.pa && val == soc->poll.val && now - soc->poll.when <= SOC_POLL_MAX_LOOP && cpu->CPSR == soc->poll.CPSR;
+	for(i = 0; i < 16; i++){
+		
+		if(cpu->regs[i] != soc->poll.regs[i]) same = false;
+		soc->poll.regs[i] = cpu->regs[i];
+	}
+	if(same){
+		
+		soc->pollSkip = true;
+		cpuAttention(cpu);
+	}
+	
+	soc->poll.pa = pa;
+	soc->poll.val = val;
+	soc->poll.when = now;
+	soc->poll.CPSR = cpu->CPSR;
+}
+
 static Boolean vMemF(ArmCpu* cpu, void* buf, UInt32 vaddr, UInt8 size, Boolean write, Boolean priviledged, UInt8* fsrP){
 	
 	SoC* soc = cpu->userData;
-	UInt32 pa;
+	UInt32 pa, mapSz;
+	UInt8* host;
 	
 	if(size & (size - 1)){	//size is not a power of two
 		
@@ -47,10 +83,204 @@ static Boolean vMemF(ArmCpu* cpu, void* buf, UInt32 vaddr, UInt8 size, Boolean w
 		
 		return false;	
 	}
+	
+	host = mmuDtlbLookup(&soc->mmu, vaddr, priviledged, write);
+	if(!host){
+		
+		if(!mmuTranslate(&soc->mmu, vaddr, priviledged, write, &pa, fsrP, &mapSz)) return false;
+		
+		if((mapSz && mapSz < MMU_DTLB_PAGE_SZ) || !(host = memGetHostPtr(&soc->mem, pa &~ (MMU_DTLB_PAGE_SZ - 1), MMU_DTLB_PAGE_SZ))){
+			
+			if(!memAccess(&soc->mem, pa, size, write, buf)) return false;	//devices and odd mappings always take the long way
+			
+			if(write) soc->poll.pa = SOC_POLL_NONE;				//any device write breaks a polling loop
+			else if(size == 4) socPrvNoteDevRead(soc, pa, *(UInt32*)buf);
+			else if(size == 2) socPrvNoteDevRead(soc, pa, *(UInt16*)buf);
+			else if(size == 1) socPrvNoteDevRead(soc, pa, *(UInt8*)buf);
+			return true;
+		}
+		
+		mmuDtlbFill(&soc->mmu, vaddr, priviledged, write, host, mapSz);
+		host += pa & (MMU_DTLB_PAGE_SZ - 1);
+	}
+	
+	switch(size){	//our memory system is little-endian
+		
+		case 1:
+			
+			if(write) *host = *(UInt8*)buf;
+			else *(UInt8*)buf = *host;
+			break;
+		
+		case 2:
+			
+			if(write) *(UInt16*)host = *(UInt16*)buf;
+			else *(UInt16*)buf = *(UInt16*)host;
+			break;
+		
+		case 4:
+			
+			if(write) *(UInt32*)host = *(UInt32*)buf;
+			else *(UInt32*)buf = *(UInt32*)host;
+			break;
+		
+		default:
+			
+			if(write) __mem_copy(host, buf, size);
+			else __mem_copy(buf, host, size);
+			break;
+	}
+	
+	return true;
+}
+
+
+static Boolean socPrvBlkBuf(SoC* soc, UInt32 sec, UInt8 op){		//op on our own one-sector buffer
+	
+	BlkSeg seg;
+	
+	seg.ptr = soc->blkDevBuf;
+	seg.len = BLK_DEV_BLK_SZ;
+	
+	return soc->blkF(soc->blkD, sec, &seg, 1, op);
+}
+
+static Boolean socPrvBlkBounce(SoC* soc, UInt32 sec, UInt32 pa, Boolean write){	//for guest memory with no host pointer (callout RAM)
+	
+	UInt32 i;
+	
+	if(!write && !socPrvBlkBuf(soc, sec, BLK_OP_READ)) return false;
+	
+	for(i = 0; i < BLK_DEV_BLK_SZ / sizeof(UInt32); i++){
+		
+		if(!memAccess(&soc->mem, pa + i * sizeof(UInt32), sizeof(UInt32), !write, soc->blkDevBuf + i)) return false;
+	}
+	
+	return !write || socPrvBlkBuf(soc, sec, BLK_OP_WRITE);
+}
+
+static UInt32 socPrvBlkRange(SoC* soc, UInt32 sec, UInt32 pa, UInt32 num, Boolean write){	//returns sectors done
+	
+	BlkSeg seg;
+	UInt32 i;
+	
+	if(num > RAM_SIZE / BLK_DEV_BLK_SZ) return 0;	//no way that fits anywhere
+	
+	seg.ptr = memGetHostPtr(&soc->mem, pa, num * BLK_DEV_BLK_SZ);
+	seg.len = num * BLK_DEV_BLK_SZ;
+	if(seg.ptr) return soc->blkF(soc->blkD, sec, &seg, 1, write ? BLK_OP_WRITE : BLK_OP_READ) ? num : 0;
+	
+	for(i = 0; i < num && socPrvBlkBounce(soc, sec + i, pa + i * BLK_DEV_BLK_SZ, write); i++);
+	
+	return i;
+}
+
+static UInt32 socPrvBlkSegs(SoC* soc, UInt32 sec, UInt32 listPa, UInt32 numSegs, Boolean write){	//guest list of {pa, len} pairs, returns sectors done
+	
+	BlkSeg segs[BLK_MAX_SEGS];
+	UInt32 i, pa, len, done = 0, pending = 0, n = 0, t, total = 0;
+	
+	if(numSegs > BLK_MAX_SEGS) return 0;
+	
+	for(i = 0; i < numSegs; i++){
+		
+		if(!memAccess(&soc->mem, listPa + i * 8 + 0, sizeof(UInt32), false, &pa)) break;
+		if(!memAccess(&soc->mem, listPa + i * 8 + 4, sizeof(UInt32), false, &len)) break;
+		if(!len || len % BLK_DEV_BLK_SZ || len > RAM_SIZE) break;
+		total += len;			//at most BLK_MAX_SEGS * RAM_SIZE, no wrap
+		if(total > RAM_SIZE) break;	//no way that fits anywhere
+		
+		segs[n].ptr = memGetHostPtr(&soc->mem, pa, len);
+		if(segs[n].ptr){
+			
+			segs[n++].len = len;
+			pending += len / BLK_DEV_BLK_SZ;
+			continue;
+		}
+		
+		//no host pointer: send what we gathered so far as one op, then do this one the slow way
+		if(n && !soc->blkF(soc->blkD, sec + done, segs, n, write ? BLK_OP_WRITE : BLK_OP_READ)) return done;
+		done += pending;
+		n = pending = 0;
+		
+		t = socPrvBlkRange(soc, sec + done, pa, len / BLK_DEV_BLK_SZ, write);
+		done += t;
+		if(t != len / BLK_DEV_BLK_SZ) return done;
+	}
+	
+	if(n && soc->blkF(soc->blkD, sec + done, segs, n, write ? BLK_OP_WRITE : BLK_OP_READ)) done += pending;
+	
+	return done;
+}
+
+/*
+	async requests: the guest hands us a segment list and goes on running, the backend does the I/O in the background
+	straight to/from guest memory. socRun() polls it while one is in flight and raises PXA255_I_PVD when it is done,
+	the guest then acks it and gets the number of sectors moved. one request at a time. if the backend cannot do it
+	in the background, or some of the memory has no host pointer, it gets done right away and the irq goes up at once
+*/
+
+static void socPrvBlkComplete(SoC* soc, UInt32 secs){
+	
+	soc->blkBusy = false;
+	soc->blkDoneSecs = secs;
+	pxa255icInt(&soc->ic, PXA255_I_PVD, true);
+}
+
+static Boolean socPrvBlkSubmit(SoC* soc, UInt32 sec, UInt32 listPa, UInt32 numSegs, Boolean write){
+	
+	BlkSeg segs[BLK_MAX_SEGS];
+	UInt32 i, pa, len, secs = 0;
+	
+	if(soc->blkBusy || !numSegs || numSegs > BLK_MAX_SEGS) return false;
+	
+	for(i = 0; i < numSegs; i++){
+		
+		if(!memAccess(&soc->mem, listPa + i * 8 + 0, sizeof(UInt32), false, &pa)) return false;
+		if(!memAccess(&soc->mem, listPa + i * 8 + 4, sizeof(UInt32), false, &len)) return false;
+		if(!len || len % BLK_DEV_BLK_SZ || len > RAM_SIZE) return false;
+		if(secs + len / BLK_DEV_BLK_SZ > RAM_SIZE / BLK_DEV_BLK_SZ) return false;	//no way that fits anywhere
+		
+		segs[i].ptr = memGetHostPtr(&soc->mem, pa, len);
+		segs[i].len = len;
+		secs += len / BLK_DEV_BLK_SZ;
+		if(!segs[i].ptr) break;
+	}
+	
+	if(i == numSegs && soc->blkF(soc->blkD, sec, segs, numSegs, (write ? BLK_OP_WRITE : BLK_OP_READ) | BLK_OP_ASYNC)){
+		
+		soc->blkBusy = true;
+		soc->blkDoneSecs = secs;
+	}
+	else socPrvBlkComplete(soc, socPrvBlkSegs(soc, sec, listPa, numSegs, write));
+	
+	return true;
+}
 
-	return mmuTranslate(&soc->mmu, vaddr, priviledged, write, &pa, fsrP) && memAccess(&soc->mem, pa, size, write, buf);
+static Boolean socPrvBlkFlush(SoC* soc){	//completes with 1 if it worked, 0 if not
+	
+	if(soc->blkBusy) return false;
+	
+	if(soc->blkF(soc->blkD, 0, NULL, 0, BLK_OP_FLUSH | BLK_OP_ASYNC)){
+		
+		soc->blkBusy = true;
+		soc->blkDoneSecs = 1;
+	}
+	else socPrvBlkComplete(soc, soc->blkF(soc->blkD, 0, NULL, 0, BLK_OP_FLUSH) ? 1 : 0);
+	
+	return true;
 }
 
+static void socPrvBlkPoll(SoC* soc){
+	
+	Boolean ok;
+	BlkSeg seg;
+	
+	seg.ptr = &ok;
+	seg.len = sizeof(ok);
+	
+	if(soc->blkF(soc->blkD, 0, &seg, 1, BLK_OP_POLL)) socPrvBlkComplete(soc, ok ? soc->blkDoneSecs : 0);
+}
 
 static Boolean hyperF(ArmCpu* cpu){		//return true if handled
 
@@ -62,6 +292,7 @@ static Boolean hyperF(ArmCpu* cpu){		//return true if handled
 		
 			err_str("Hypercall 0 caught\r\n");
 			soc->go = false;
+			cpuAttention(cpu);
 			break;
 		}
 		
@@ -89,10 +320,13 @@ static Boolean hyperF(ArmCpu* cpu){		//return true if handled
 		case 4:{			//block device access perform [do a read or write]
 		
 			//IN:
-			// R0 = op
+			// R0 = op (BLK_OP_SIZE, BLK_OP_READ or BLK_OP_WRITE)
 			// R1 = sector
 			
-			return soc->blkF(soc->blkD, cpu->regs[1], soc->blkDevBuf, cpu->regs[0]);
+			if(cpu->regs[0] != BLK_OP_SIZE && cpu->regs[0] != BLK_OP_READ && cpu->regs[0] != BLK_OP_WRITE) return false;
+			if(soc->blkBusy) return false;		//the backend is not to be called while it is still doing an async request, nor would we want its completion taken
+			
+			return socPrvBlkBuf(soc, cpu->regs[1], cpu->regs[0]);
 		}
 		
 		case 5:{			//block device buffer access [read or fill emulator's buffer]
@@ -115,6 +349,68 @@ static Boolean hyperF(ArmCpu* cpu){		//return true if handled
 				soc->blkDevBuf[cpu->regs[1]] = cpu->regs[0];
 			}
 			else return false;
+			break;
+		}
+		
+		case 6:				//block device read straight into guest memory
+		case 7:{			//block device write straight from guest memory
+			
+			//IN:
+			// R0 = guest physical address
+			// R1 = first sector
+			// R2 = number of sectors
+			//OUT:
+			// R0 = number of sectors transferred (none while an async request is in flight)
+			
+			cpu->regs[0] = soc->blkBusy ? 0 : socPrvBlkRange(soc, cpu->regs[1], cpu->regs[0], cpu->regs[2], cpu->regs[12] == 7);
+			break;
+		}
+		
+		case 8:				//block device scatter-gather read
+		case 9:{			//block device scatter-gather write
+			
+			//IN:
+			// R0 = guest physical address of the segment list: {UInt32 pa, UInt32 len} each, len a multiple of the sector size
+			// R1 = first sector
+			// R2 = number of segments (at most BLK_MAX_SEGS)
+			//OUT:
+			// R0 = number of sectors transferred (none while an async request is in flight)
+			
+			cpu->regs[0] = soc->blkBusy ? 0 : socPrvBlkSegs(soc, cpu->regs[1], cpu->regs[0], cpu->regs[2], cpu->regs[12] == 9);
+			break;
+		}
+		
+		case 10:			//block device async scatter-gather read
+		case 11:{			//block device async scatter-gather write
+			
+			//IN:
+			// R0 = guest physical address of the segment list, as for 8 & 9
+			// R1 = first sector
+			// R2 = number of segments (at most BLK_MAX_SEGS)
+			//OUT:
+			// R0 = 1 if accepted, PXA255_I_PVD goes up when it is done. 0 if not (bad list or one already in flight)
+			
+			cpu->regs[0] = socPrvBlkSubmit(soc, cpu->regs[1], cpu->regs[0], cpu->regs[2], cpu->regs[12] == 11);
+			break;
+		}
+		
+		case 12:{			//block device async completion ack
+			
+			//OUT:
+			// R0 = number of sectors the finished request transferred (for a flush: 1 if it worked, 0 if not)
+			
+			cpu->regs[0] = soc->blkDoneSecs;
+			pxa255icInt(&soc->ic, PXA255_I_PVD, false);
+			break;
+		}
+		
+		case 13:{			//block device async flush: all writes done so far get to stable storage
+			
+			//OUT:
+			// R0 = 1 if accepted, PXA255_I_PVD goes up when it is done. 0 if not (one already in flight)
+			
+			cpu->regs[0] = socPrvBlkFlush(soc);
+			break;
 		}
 	}
 	return true;
@@ -141,6 +437,13 @@ static Boolean pMemReadF(void* userData, UInt32* buf, UInt32 pa){	//for DMA engi
 	return memAccess(mem, pa, 4, false, buf);
 }
 
+static UInt8* pMemHostPtrF(void* userData, UInt32 pa, UInt32 sz){	//for MMU pagetable walks
+
+	ArmMem* mem = userData;
+
+	return memGetHostPtr(mem, pa, sz);
+}
+
 static void dumpCpuState(ArmCpu* cpu, char* label){
 
 	UInt8 i;
@@ -209,6 +512,38 @@ void socRamModeCallout(SoC* soc, void* callout){
 
 #define ERR_(s)	ERR("error");
 
+#define SOC_TIMR_PERIOD		8UL		//in instrs, per OSCR tick
+#define SOC_UART_PERIOD		256UL
+#define SOC_RTC_PERIOD		4096UL
+#define SOC_MAX_RUN		0x10000UL	//longest we let the cpu go without looking at soc->go
+#define SOC_MAX_IDLE_NS		50000000ULL	//longest the host sleeps at a time for an idle guest
+#define SOC_SNAP_MAGIC		0x70616E73UL	//"snap"
+#define SOC_SNAP_VERSION	2		//bump on any change to what a fooSnap() writes, streams carry no layout of their own
+#define SOC_SNAP_PAGE		4096UL
+#define SOC_SNAP_PAGE_END	0xFFFFFFFFUL
+
+static void socPrvSchedKick(void* userData){
+	
+	SoC* soc = userData;
+	
+	cpuAttention(&soc->cpu);
+}
+
+static UInt32 socPrvSchedElapsed(void* userData){
+	
+	SoC* soc = userData;
+	
+	return cpuRunElapsed(&soc->cpu);
+}
+
+static void socPrvRtcEvt(void* userData){
+	
+	SoC* soc = userData;
+	
+	pxa255rtcUpdate(&soc->rtc);
+	schedAt(&soc->sched, &soc->rtcEvt, soc->rtcEvt.when + SOC_RTC_PERIOD);
+}
+
 void socInit(SoC* soc, SocRamAddF raF, void*raD, readcharF rc, writecharF wc, blockOp blkF, void* blkD){
 
 	Err e;
@@ -220,6 +555,9 @@ void socInit(SoC* soc, SocRamAddF raF, void*raD, readcharF rc, writecharF wc, bl
 	soc->blkD = blkD;
 
 	soc->go = true;
+	soc->pollSkip = false;
+	soc->blkBusy = false;
+	soc->poll.pa = SOC_POLL_NONE;
 	
 	e = cpuInit(&soc->cpu, ROM_BASE, vMemF, emulErrF, hyperF, &setFaultAdrF);
 	if(e){
@@ -230,8 +568,10 @@ void socInit(SoC* soc, SocRamAddF raF, void*raD, readcharF rc, writecharF wc, bl
 	}
 	soc->cpu.userData = soc;
 	
+	schedInit(&soc->sched, socPrvSchedKick, socPrvSchedElapsed, soc);
+	
 	memInit(&soc->mem);
-	mmuInit(&soc->mmu, pMemReadF, &soc->mem);
+	mmuInit(&soc->mmu, pMemReadF, pMemHostPtrF, &soc->mem);
 	
 	if(ROM_SIZE > sizeof(soc->romMem)) {
 	//	err_str("Failed to init CPU: ");
@@ -249,7 +589,7 @@ void socInit(SoC* soc, SocRamAddF raF, void*raD, readcharF rc, writecharF wc, bl
 	__mem_copy(soc->romMem, embedded_boot, sizeof(embedded_boot));
 	
 	if(!pxa255icInit(&soc->ic, &soc->cpu, &soc->mem)) ERR_("Cannot init PXA255's interrupt controller");
-	if(!pxa255timrInit(&soc->timr, &soc->mem, &soc->ic)) ERR_("Cannot init PXA255's OS timers");
+	if(!pxa255timrInit(&soc->timr, &soc->mem, &soc->ic, &soc->sched, SOC_TIMR_PERIOD)) ERR_("Cannot init PXA255's OS timers");
 	if(!pxa255rtcInit(&soc->rtc, &soc->mem, &soc->ic)) ERR_("Cannot init PXA255's RTC");
 	if(!pxa255uartInit(&soc->ffuart, &soc->mem, &soc->ic,PXA255_FFUART_BASE, PXA255_I_FFUART)) ERR_("Cannot init PXA255's FFUART");
 	if(!pxa255uartInit(&soc->btuart, &soc->mem, &soc->ic,PXA255_BTUART_BASE, PXA255_I_BTUART)) ERR_("Cannot init PXA255's BTUART");
@@ -260,18 +600,190 @@ void socInit(SoC* soc, SocRamAddF raF, void*raD, readcharF rc, writecharF wc, bl
 	if(!pxa255dspInit(&soc->dsp, &soc->cpu)) ERR_("Cannot init PXA255's cp0 DSP");
 	
 	pxa255uartSetFuncs(&soc->ffuart, socUartPrvRead, socUartPrvWrite, soc);	
+	pxa255uartSetSched(&soc->ffuart, &soc->sched, SOC_UART_PERIOD);
+	pxa255uartSetFastTx(&soc->ffuart, true);		//nobody is there to notice the console has no baud rate
+	
+	//devices get ticked before the instr that hits their period, hence the "- 1"
+	schedEventInit(&soc->rtcEvt, socPrvRtcEvt, soc);
+	schedAt(&soc->sched, &soc->rtcEvt, SOC_RTC_PERIOD - 1);
+}
+
+void socSetPacedTimer(SoC* soc, Boolean paced){
+	
+	soc->pacedTimer = paced;
+	pxa255timrSetPaced(&soc->timr, paced);
+}
+
+void socStop(SoC* soc){
+	
+	soc->go = false;
+	cpuAttention(&soc->cpu);
+}
+
+/*
+	a snapshot is a small header, the state of each module in a fixed order, then RAM. most of a booted guest's RAM
+	is still zero, so RAM goes as a list of (page number, page) for the pages that are not, ending in
+	SOC_SNAP_PAGE_END. the sched's time goes first, modules restoring their events post them in its terms. the disk
+	is not ours to save, whoever restores has to give us the one we had (or a copy of it)
+*/
+
+static void socPrvSnapRam(SoC* soc, Snap* s){
+	
+	UInt32* ram = soc->ram.RAM.buf;
+	UInt32 page, i;
+	
+	if(s->load){
+		
+		for(i = 0; i < RAM_SIZE / sizeof(UInt32); i++) ram[i] = 0;	//__mem_zero() only does up to 64K
+		while(s->ok){
+			
+			page = snapU32(s, SOC_SNAP_PAGE_END);
+			if(page == SOC_SNAP_PAGE_END) break;
+			if(page >= RAM_SIZE / SOC_SNAP_PAGE) s->ok = false;
+			else snapBytes(s, ram + page * (SOC_SNAP_PAGE / sizeof(UInt32)), SOC_SNAP_PAGE);
+		}
+		return;
+	}
+	
+	for(page = 0; page < RAM_SIZE / SOC_SNAP_PAGE; page++, ram += SOC_SNAP_PAGE / sizeof(UInt32)){
+		
+		for(i = 0; i < SOC_SNAP_PAGE / sizeof(UInt32) && !ram[i]; i++);
+		if(i == SOC_SNAP_PAGE / sizeof(UInt32)) continue;
+		
+		snapU32(s, page);
+		snapBytes(s, ram, SOC_SNAP_PAGE);
+	}
+	snapU32(s, SOC_SNAP_PAGE_END);
+}
+
+static Boolean socPrvSnap(SoC* soc, Snap* s){
+	
+	UInt32 hdr[3], i;
+	
+	if(soc->calloutMem){
+		
+		err_str("Cannot snapshot callout RAM\r\n");
+		return false;
+	}
+	
+	hdr[0] = SOC_SNAP_MAGIC;
+	hdr[1] = SOC_SNAP_VERSION;
+	hdr[2] = RAM_SIZE;
+	snapVal(s, hdr);
+	if(s->load && s->ok && (hdr[0] != SOC_SNAP_MAGIC || hdr[1] != SOC_SNAP_VERSION || hdr[2] != RAM_SIZE)){
+		
+		err_str("Snapshot is from another version\r\n");
+		return false;
+	}
+	
+	schedSnap(&soc->sched, s);
+	cpuSnap(&soc->cpu, s);
+	cp15Snap(&soc->cp15, s);
+	pxa255icSnap(&soc->ic, s);
+	pxa255timrSnap(&soc->timr, s);
+	pxa255rtcSnap(&soc->rtc, s);
+	pxa255uartSnap(&soc->ffuart, s);
+	pxa255uartSnap(&soc->btuart, s);
+	pxa255uartSnap(&soc->stuart, s);
+	pxa255pwrClkSnap(&soc->pwrClk, s);
+	pxa255gpioSnap(&soc->gpio, s);
+	pxa255dmaSnap(&soc->dma, s);
+	pxa255dspSnap(&soc->dsp, s);
+	schedSnapEvent(&soc->sched, &soc->rtcEvt, s);
+	snapVal(s, soc->blkDevBuf);
+	snapVal(s, soc->blkDoneSecs);
+	socPrvSnapRam(soc, s);
+	
+	if(s->load){
+		
+		soc->poll.pa = SOC_POLL_NONE;
+		for(i = 0; i < 16; i++) soc->poll.regs[i] = 0;
+		soc->pollSkip = false;
+	}
+	
+	return s->ok;
+}
+
+void socBlkDrain(SoC* soc){
+	
+	while(soc->blkBusy){		//a request in flight has the guest's memory and our completion state tied up in it
+		
+		socPrvBlkPoll(soc);
+		if(soc->blkBusy) hostIdle(1000000ULL);
+	}
+}
+
+Boolean socSave(SoC* soc, SnapIoF ioF, void* userData){
+	
+	Snap s;
+	
+	socBlkDrain(soc);
+	snapInit(&s, ioF, userData, false);
+	
+	return socPrvSnap(soc, &s);
+}
+
+Boolean socRestore(SoC* soc, SnapIoF ioF, void* userData){
+	
+	Snap s;
+	
+	snapInit(&s, ioF, userData, true);
+	
+	return socPrvSnap(soc, &s);
+}
+
+static UInt64 socPrvTillNext(Sched* s){
+	
+	UInt64 left = schedNext(s) - s->now;
+	
+	return left > SOC_MAX_RUN ? SOC_MAX_RUN : left;
+}
+
+static void socPrvIdle(SoC* soc){	//the cpu waits for an interrupt, wait for guest time to get to the next deadline
+	
+	UInt64 now, wake;
+	
+	if(!soc->pacedTimer) return;	//guest time is instrs executed, so it is already there
+	
+	now = hostClockNs();
+	wake = pxa255timrPacedNextNs(&soc->timr);
+	if(wake > now + SOC_MAX_IDLE_NS) wake = now + SOC_MAX_IDLE_NS;
+	if(wake > now) hostIdle(wake - now);
 }
 
 void socRun(SoC* soc){
-	UInt32 cycles = 0;	//make 64 if you REALLY need it... later
+	
+	Sched* s = &soc->sched;
+	UInt64 left;
+	UInt32 done;
 	
 	while(soc->go){
-		cycles++;
 		
-		if(!(cycles & 0x000007UL)) pxa255timrTick(&soc->timr);
-		if(!(cycles & 0x0000FFUL)) pxa255uartProcess(&soc->ffuart);
-		if(!(cycles & 0x000FFFUL)) pxa255rtcUpdate(&soc->rtc);
+		if(hostConsoleReady()) pxa255uartRxReady(&soc->ffuart);
+		if(soc->blkBusy) socPrvBlkPoll(soc);
+		schedRunDue(s);		//anything due is called here, so the next deadline is always in the future
+		
+		left = socPrvTillNext(s);
 		
-		cpuCycle(&soc->cpu);
+		//run up to the next deadline. cpuRun() can overshoot by a block of instrs under the dynarec, schedRunDue() then calls every event we passed
+		done = cpuRun(&soc->cpu, left);
+		
+		if(!done && cpuIsSleeping(&soc->cpu) && soc->blkBusy && !soc->pacedTimer){
+			
+			//waiting on the disk. guest time is instrs executed, so it stands still till the backend is done, as it did when disk I/O was synchronous
+			hostIdle(SOC_MAX_IDLE_NS);
+		}
+		else if(!done && cpuIsSleeping(&soc->cpu)){	//nothing will happen till the next deadline, skip straight to it
+			
+			socPrvIdle(soc);
+			done = left;
+		}
+		else if(soc->pollSkip){			//spinning on a device register, same deal
+			
+			soc->pollSkip = false;
+			left = socPrvTillNext(s);	//the deadline may have moved closer during the run
+			if(done < left) done = left;
+		}
+		s->now += done;
 	}
 }
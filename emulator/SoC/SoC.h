@@ -2,9 +2,9 @@
 #define _SOC_H_
 
 #include "../helper/types.h"
+#include "../helper/snap.h"
 
 //#define GDB_SUPPORT
-//#define DYNAREC
 #define MAX_WTP			32
 #define MAX_BKPT		32
 
@@ -18,8 +18,21 @@ typedef void (*writecharF)(int);
 #define BLK_OP_SIZE	0
 #define BLK_OP_READ	1
 #define BLK_OP_WRITE	2
+#define BLK_OP_POLL	3	//has the op queued with BLK_OP_ASYNC finished? 0 if not, else 1 and whether it worked goes in segs->ptr (a Boolean)
+#define BLK_OP_FLUSH	4	//everything written so far is on stable storage when this returns. no segments
+#define BLK_OP_ASYNC	0x80	//with READ/WRITE: just queue it, the memory stays put till POLL says it is done. backends that cannot return 0
 
-typedef int (*blockOp)(void* data, UInt32 sec, void* ptr, UInt8 op); 
+#define BLK_MAX_SEGS	128
+
+typedef struct{
+	
+	void* ptr;
+	UInt32 len;		//for reads and writes, a multiple of BLK_DEV_BLK_SZ
+	
+}BlkSeg;
+
+//one call moves a whole run of sectors starting at "sec" to/from the segments, in order. BLK_OP_SIZE gets one segment to put the answer in
+typedef int (*blockOp)(void* data, UInt32 sec, const BlkSeg* segs, UInt32 numSegs, UInt8 op);
 
 struct SoC;
 
@@ -37,6 +50,12 @@ void socRamModeCallout(struct SoC* soc, void* callout);	//rally pointer to RamCa
 
 void socInit(struct SoC* soc, SocRamAddF raF, void* raD, readcharF rc, writecharF wc, blockOp blkF, void* blkD);
 void socRun(struct SoC* soc);
+void socSetPacedTimer(struct SoC* soc, Boolean paced);	//OS timer follows the host clock instead of instrs executed
+void socStop(struct SoC* soc);				//socRun() returns soon after, calling it again carries on
+void socBlkDrain(struct SoC* soc);			//waits out the async disk request in flight, if any. only while socRun() is not running
+
+Boolean socSave(struct SoC* soc, SnapIoF ioF, void* userData);		//only while socRun() is not running
+Boolean socRestore(struct SoC* soc, SnapIoF ioF, void* userData);	//into a freshly inited soc, after socSetPacedTimer(). on failure the machine is garbage
 
 
 
@@ -57,6 +76,7 @@ extern volatile UInt32 gRtc;	//needed by SoC
 #include "../pxa255/GPIO/pxa255_GPIO.h"
 #include "../pxa255/DMA/pxa255_DMA.h"
 #include "../pxa255/DSP/pxa255_DSP.h"
+#include "../sched/sched.h"
 
 typedef struct SoC{
 
@@ -67,6 +87,7 @@ typedef struct SoC{
 	void* blkD;
 	
 	UInt32 blkDevBuf[BLK_DEV_BLK_SZ / sizeof(UInt32)];
+	UInt32 blkDoneSecs;		//result of the last async request, for when the guest acks its interrupt
 
 	union{
 		ArmRam RAM;
@@ -88,8 +109,22 @@ typedef struct SoC{
 	Pxa255dma dma;
 	Pxa255dsp dsp;
 	
+	Sched sched;
+	SchedEvent rtcEvt;
+	
+	struct{			//last device read, to spot the guest spinning on a status register
+		UInt32 pa;
+		UInt32 val;
+		UInt64 when;
+		UInt32 regs[16];
+		UInt32 CPSR;
+	}poll;
+	
 	UInt8 go	:1;
 	UInt8 calloutMem:1;
+	UInt8 pacedTimer:1;
+	UInt8 pollSkip:1;
+	UInt8 blkBusy	:1;		//async request in flight
 	
 	UInt32 romMem[13];		//space for embeddedBoot
 }SoC;
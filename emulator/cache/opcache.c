@@ -0,0 +1,28 @@
+#include "../helper/types.h"
+#include "../CPU/CPU.h"
+#include "opcache.h"
+
+void opcacheInval(opcache* oc){
+
+	UInt32 i;
+
+	for(i = 0; i < OPCACHE_NUM; i++) oc->ops[i].flags = 0;
+}
+
+void opcacheInit(opcache* oc){
+
+	opcacheInval(oc);
+}
+
+void opcacheInvalAddr(opcache* oc, UInt32 va){
+
+	opcacheOp* op;
+	UInt32 end;
+
+	va &= ICACHE_ADDR_MASK;
+	for(end = va + ICACHE_LINE_SZ; va != end; va += 2){
+
+		op = opcacheSlot(oc, va);
+		if(op->va == va) op->flags = 0;
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef _OPCACHE_H_
+#define _OPCACHE_H_
+
+
+#include "../helper/types.h"
+#include "icache.h"
+
+/*
+	cache of decoded instrs. the cpu fills in a handler and whatever it could work out from the instr bits alone
+	(register numbers, immediates, addressing mode flags) so that hot code does not get decoded over and over.
+	invalidated along with the icache, so it follows the same rules as to when code may change
+*/
+
+#define OPCACHE_S		10UL	//number of entries is 2^S
+
+
+#define OPCACHE_NUM		(1UL << OPCACHE_S)
+
+#define OPCACHE_VALID		0x01
+#define OPCACHE_PRIV		0x02	//decoded from privileged mode
+#define OPCACHE_THUMB		0x04	//thumb instr (kept as is, they are cheap to decode)
+
+#define OPCACHE_KEY_MASK	(OPCACHE_VALID | OPCACHE_PRIV | OPCACHE_THUMB)
+
+struct opcacheOp;
+
+typedef Err (*OpcacheExecF)(struct ArmCpu* cpu, const struct opcacheOp* op, UInt32 pc, Boolean privileged);
+
+typedef struct opcacheOp{
+
+	UInt32 va;
+	UInt32 instr;
+	OpcacheExecF exec;
+	UInt32 imm;		//pre-computed by the decoder: shifter operand, offset or branch target
+	UInt32 imm2;		//pre-computed by the decoder: writeback offset
+	UInt8 mode;		//decoder's own bits (addressing mode flags, carry out)
+	UInt8 flags;
+
+}opcacheOp;
+
+typedef struct{
+
+	opcacheOp ops[OPCACHE_NUM];
+
+}opcache;
+
+
+void opcacheInit(opcache* oc);
+void opcacheInval(opcache* oc);
+void opcacheInvalAddr(opcache* oc, UInt32 va);	//drops the whole icache line at va
+
+
+static _INLINE_ opcacheOp* opcacheSlot(opcache* oc, UInt32 va){	//where the op for va lives (or would)
+
+	return oc->ops + (((va >> 2) ^ ((va & 2) << (OPCACHE_S - 2))) & (OPCACHE_NUM - 1));
+}
+
+static _INLINE_ Boolean opcacheHit(const opcacheOp* op, UInt32 va, UInt8 key){	//key is OPCACHE_PRIV and/or OPCACHE_THUMB
+
+	return op->va == va && (op->flags & OPCACHE_KEY_MASK) == (key | OPCACHE_VALID);
+}
+
+
+#endif
@@ -0,0 +1,906 @@
+#include "../CPU/CPU.h"
+
+#ifdef DYNAREC
+
+#ifndef __x86_64__
+	#error "the dynarec produces x86-64 code only"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "../helper/external.h"
+#include "../math/math64.h"
+#include "x86_64.h"
+
+/*
+	translation is done one basic block at a time and blocks never span 4K pages. while a block runs, RBX points to the
+	ArmCpu, RBP & R12 are ours to keep values in across helper calls, everything else is scratch. regs[15] is not kept up
+	to date inside a block - reads of PC are constants, and every exit from a block stores the proper PC before leaving.
+	anything we do not care to translate is handed to the interpreter one instr at a time
+*/
+
+#define OFFT_REG(n)		((Int32)(offsetof(ArmCpu, regs) + 4 * (n)))
+#define OFFT_CPSR		((Int32)offsetof(ArmCpu, CPSR))
+
+#define DYNAREC_ABORTED		0x100000000ULL	//load helper result when it took a data abort
+
+#define XLAT_FAIL		0	//not translated, interpreter should do it
+#define XLAT_OK			1
+#define XLAT_END		2	//control never falls through to the next instr
+
+#define CARRY_SAME		0	//shifter does not touch C flag
+#define CARRY_CLEAR		1
+#define CARRY_SET		2
+#define CARRY_R10		3	//shifter carry out is in R10B
+
+typedef struct{
+
+	UInt8* p;		//where code goes
+	UInt32 pc;		//address of the instr being translated
+	UInt32 pcVal;		//what that instr sees when it reads PC
+	UInt32 count;		//instrs executed if we leave during the current one
+	UInt8* skip;		//jump to patch for when the condition fails, if any
+	Boolean T;
+
+}DynarecXlat;
+
+
+static UInt64 dynarecPrvLoad(ArmCpu* cpu, UInt32 va, UInt32 sz, UInt32 pcNext){
+
+	Boolean priv = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
+	UInt32 v32 = 0;
+	UInt16 v16 = 0;
+	UInt8 v8 = 0, fsr = 0;
+	Boolean ok;
+
+	switch(sz){
+		case 1:
+			ok = cpu->memF(cpu, &v8, va, 1, false, priv, &fsr);
+			v32 = v8;
+			break;
+		case 2:
+			ok = cpu->memF(cpu, &v16, va, 2, false, priv, &fsr);
+			v32 = v16;
+			break;
+		default:
+			ok = cpu->memF(cpu, &v32, va, 4, false, priv, &fsr);
+			break;
+	}
+	if(ok) return v32;
+
+	cpu->regs[15] = pcNext;
+	cpuDynarecDataAbort(cpu, va, sz, false, fsr);
+	return DYNAREC_ABORTED;
+}
+
+static UInt32 dynarecPrvStore(ArmCpu* cpu, UInt32 va, UInt32 val, UInt32 sz, UInt32 pcNext){
+
+	Boolean priv = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
+	UInt16 v16 = val;
+	UInt8 v8 = val, fsr = 0;
+	Boolean ok;
+
+	switch(sz){
+		case 1:
+			ok = cpu->memF(cpu, &v8, va, 1, true, priv, &fsr);
+			break;
+		case 2:
+			ok = cpu->memF(cpu, &v16, va, 2, true, priv, &fsr);
+			break;
+		default:
+			ok = cpu->memF(cpu, &val, va, 4, true, priv, &fsr);
+			break;
+	}
+	if(ok) return true;
+
+	cpu->regs[15] = pcNext;
+	cpuDynarecDataAbort(cpu, va, sz, true, fsr);
+	return false;
+}
+
+static _INLINE_ UInt32 dynarecPrvPcNext(DynarecXlat* x){
+
+	return x->pc + (x->T ? 2 : 4);
+}
+
+static void dynarecPrvExit(DynarecXlat* x){	//PC must already be stored
+
+	x86_mov_reg_imm(&x->p, X86_EAX, x->count);
+	x86_pop(&x->p, X86_EBP);
+	x86_pop(&x->p, X86_R12);
+	x86_pop(&x->p, X86_EBX);
+	x86_ret(&x->p);
+}
+
+static void dynarecPrvExitIf(DynarecXlat* x, UInt8 cc){
+
+	UInt8* j = x86_jcc8(&x->p, cc ^ 1);	//x86 condition codes negate by flipping bit 0
+
+	dynarecPrvExit(x);
+	x86_patch8(j, x->p);
+}
+
+static void dynarecPrvCall(DynarecXlat* x, void* func){
+
+	x86_mov64_reg_reg(&x->p, X86_EDI, X86_EBX);
+	x86_call(&x->p, func);
+}
+
+static void dynarecPrvGetReg(DynarecXlat* x, UInt8 host, UInt8 reg){
+
+	if(reg == 15) x86_mov_reg_imm(&x->p, host, x->pcVal);
+	else x86_mov_reg_mem(&x->p, host, OFFT_REG(reg));
+}
+
+static Boolean dynarecPrvEndsBlock(UInt32 instr){	//instrs after which we always go back to the dispatcher
+
+	if((instr >> 28) == 0x0F) return true;						//unconditional space, hypercalls included
+	if(((instr >> 26) & 3) == 3) return true;					//coprocessor ops & SWI
+	if(!(instr & 0x0C000000UL) && (instr & 0x01900000UL) == 0x01000000UL && (instr & 0x02000000UL || (instr & 0x90) != 0x90)) return true;	//misc ops like MSR, which may unmask interrupts
+	if((instr >> 28) != 0x0E) return false;
+
+	//unconditional PC writes. we must not fetch past them, there may well be no memory there
+	switch((instr >> 25) & 7){
+
+		case 0:
+			if((instr & 0x90) == 0x90) return false;
+			//fallthrough
+		case 1:
+			return ((instr >> 12) & 0x0F) == 15 && ((instr >> 23) & 3) != 2;
+
+		case 2:
+		case 3:
+			return ((instr >> 12) & 0x0F) == 15 && (instr & 0x00100000UL);
+
+		case 4:
+			return (instr & 0x00108000UL) == 0x00108000UL;
+	}
+
+	return false;
+}
+
+static void dynarecPrvCond(DynarecXlat* x, UInt8 cond){	//emit a skip over the instr for when cond fails
+
+	UInt8** p = &x->p;
+	UInt8 cc;
+
+	x->skip = NULL;
+	switch(cond >> 1){
+
+		case 0:		//EQ/NE
+			x86_test_mem_imm(p, OFFT_CPSR, ARM_SR_Z);
+			cc = X86_CC_Z;
+			break;
+
+		case 1:		//CS/CC
+			x86_test_mem_imm(p, OFFT_CPSR, ARM_SR_C);
+			cc = X86_CC_Z;
+			break;
+
+		case 2:		//MI/PL
+			x86_test_mem_imm(p, OFFT_CPSR, ARM_SR_N);
+			cc = X86_CC_Z;
+			break;
+
+		case 3:		//VS/VC
+			x86_test_mem_imm(p, OFFT_CPSR, ARM_SR_V);
+			cc = X86_CC_Z;
+			break;
+
+		case 4:		//HI/LS: C set and Z clear
+			x86_mov_reg_mem(p, X86_EAX, OFFT_CPSR);
+			x86_alu_reg_imm(p, X86_ALU_AND, X86_EAX, ARM_SR_C | ARM_SR_Z);
+			x86_alu_reg_imm(p, X86_ALU_CMP, X86_EAX, ARM_SR_C);
+			cc = X86_CC_NZ;
+			break;
+
+		case 5:		//GE/LT: sign of (N ^ V)
+			x86_mov_reg_mem(p, X86_EAX, OFFT_CPSR);
+			x86_mov_reg_reg(p, X86_ECX, X86_EAX);
+			x86_shift_imm(p, X86_SHF_SHL, X86_ECX, 3);
+			x86_alu_reg_reg(p, X86_ALU_XOR, X86_EAX, X86_ECX);
+			cc = X86_CC_S;
+			break;
+
+		case 6:		//GT/LE: sign of (Z | (N ^ V))
+			x86_mov_reg_mem(p, X86_EAX, OFFT_CPSR);
+			x86_mov_reg_reg(p, X86_ECX, X86_EAX);
+			x86_shift_imm(p, X86_SHF_SHL, X86_ECX, 3);
+			x86_alu_reg_reg(p, X86_ALU_XOR, X86_ECX, X86_EAX);
+			x86_alu_reg_imm(p, X86_ALU_AND, X86_EAX, ARM_SR_Z);
+			x86_shift_imm(p, X86_SHF_SHL, X86_EAX, 1);
+			x86_alu_reg_reg(p, X86_ALU_OR, X86_EAX, X86_ECX);
+			cc = X86_CC_S;
+			break;
+
+		default:	//AL
+			return;
+	}
+	if(cond & 1) cc ^= 1;
+
+	x->skip = x86_jcc(p, cc);
+}
+
+static void dynarecPrvCondEnd(DynarecXlat* x){
+
+	if(x->skip) x86_patch(x->skip, x->p);
+}
+
+static UInt8 dynarecPrvEnd(UInt32 instr){	//what to report for an instr that always leaves the block when it executes
+
+	return (instr >> 28) == 0x0E ? XLAT_END : XLAT_OK;
+}
+
+static void dynarecPrvSetFlags(DynarecXlat* x, UInt8 carry, Boolean overflow){	//N & Z from EAX, C as given, V from R11B if requested. clobbers ECX, EDX
+
+	UInt8** p = &x->p;
+	UInt32 mask = ARM_SR_N | ARM_SR_Z;
+
+	if(carry != CARRY_SAME) mask |= ARM_SR_C;
+	if(overflow) mask |= ARM_SR_V;
+
+	x86_mov_reg_mem(p, X86_ECX, OFFT_CPSR);
+	x86_alu_reg_imm(p, X86_ALU_AND, X86_ECX, ~mask);
+
+	x86_mov_reg_reg(p, X86_EDX, X86_EAX);
+	x86_alu_reg_imm(p, X86_ALU_AND, X86_EDX, ARM_SR_N);
+	x86_alu_reg_reg(p, X86_ALU_OR, X86_ECX, X86_EDX);
+
+	x86_alu_reg_imm(p, X86_ALU_CMP, X86_EAX, 1);		//CF = !EAX
+	x86_alu_reg_reg(p, X86_ALU_SBB, X86_EDX, X86_EDX);
+	x86_alu_reg_imm(p, X86_ALU_AND, X86_EDX, ARM_SR_Z);
+	x86_alu_reg_reg(p, X86_ALU_OR, X86_ECX, X86_EDX);
+
+	if(carry == CARRY_SET){
+
+		x86_alu_reg_imm(p, X86_ALU_OR, X86_ECX, ARM_SR_C);
+	}
+	else if(carry == CARRY_R10){
+
+		x86_movx(p, X86_MOVZX8, X86_EDX, X86_R10);
+		x86_shift_imm(p, X86_SHF_SHL, X86_EDX, 29);
+		x86_alu_reg_reg(p, X86_ALU_OR, X86_ECX, X86_EDX);
+	}
+	if(overflow){
+
+		x86_movx(p, X86_MOVZX8, X86_EDX, X86_R11);
+		x86_shift_imm(p, X86_SHF_SHL, X86_EDX, 28);
+		x86_alu_reg_reg(p, X86_ALU_OR, X86_ECX, X86_EDX);
+	}
+
+	x86_mov_mem_reg(p, OFFT_CPSR, X86_ECX);
+}
+
+static void dynarecPrvImmShift(DynarecXlat* x, UInt8 reg, UInt8 type, UInt8 amt, Boolean wantCarry){	//shift reg by a constant as the ARM shifter would, carry out to R10B if wanted (and it changes)
+
+	UInt8** p = &x->p;
+	static const UInt8 ops[] = {X86_SHF_SHL, X86_SHF_SHR, X86_SHF_SAR, X86_SHF_ROR};
+
+	if(!amt){
+		switch(type){
+
+			case 0:		//LSL #0 does nothing
+				return;
+
+			case 1:		//LSR #32
+				if(wantCarry){
+					x86_bt64_reg_imm(p, reg, 31);
+					x86_setcc(p, X86_CC_C, X86_R10);
+				}
+				x86_alu_reg_reg(p, X86_ALU_XOR, reg, reg);
+				return;
+
+			case 2:		//ASR #32
+				if(wantCarry){
+					x86_bt64_reg_imm(p, reg, 31);
+					x86_setcc(p, X86_CC_C, X86_R10);
+				}
+				x86_shift_imm(p, X86_SHF_SAR, reg, 31);
+				return;
+
+			case 3:		//RRX
+				x86_bt_mem_imm(p, OFFT_CPSR, 29);
+				x86_shift_imm(p, X86_SHF_RCR, reg, 1);
+				break;
+		}
+	}
+	else x86_shift_imm(p, ops[type], reg, amt);
+
+	if(wantCarry) x86_setcc(p, X86_CC_C, X86_R10);
+}
+
+static UInt8 dynarecPrvDataProc(DynarecXlat* x, UInt32 instr){
+
+	static const UInt8 aluOps[] = {X86_ALU_AND, X86_ALU_XOR, X86_ALU_SUB, 0, X86_ALU_ADD, X86_ALU_ADC, X86_ALU_SBB, 0, X86_ALU_AND, X86_ALU_XOR, X86_ALU_SUB, X86_ALU_ADD, X86_ALU_OR, 0, X86_ALU_AND, 0};
+	UInt8** p = &x->p;
+	UInt8 op = (instr >> 21) & 0x0F, Rn = (instr >> 16) & 0x0F, Rd = (instr >> 12) & 0x0F, carry = CARRY_SAME, amt;
+	Boolean S = (instr & 0x00100000UL) != 0, logical = (0xF303 >> op) & 1, store = op < 8 || op > 11;
+	UInt32 v;
+
+	if(!(instr & 0x02000000UL) && (instr & 0x10)) return XLAT_FAIL;	//register shifted by register
+	if(store && Rd == 15) return XLAT_FAIL;				//PC writes may change mode & state, interpreter deals with those
+	if(!store && !S) return XLAT_FAIL;					//misc instrs space
+
+	dynarecPrvCond(x, instr >> 28);
+
+	//shifter operand into ECX
+	if(instr & 0x02000000UL){
+
+		amt = (instr >> 7) & 0x1E;
+		v = instr & 0xFF;
+		if(amt){
+			v = (v >> amt) | (v << (32 - amt));
+			carry = (v & 0x80000000UL) ? CARRY_SET : CARRY_CLEAR;
+		}
+		x86_mov_reg_imm(p, X86_ECX, v);
+	}
+	else{
+
+		dynarecPrvGetReg(x, X86_ECX, instr & 0x0F);
+		dynarecPrvImmShift(x, X86_ECX, (instr >> 5) & 3, (instr >> 7) & 0x1F, S && logical);
+		if(((instr >> 5) & 3) || (instr & 0x00000F80UL)) carry = CARRY_R10;
+	}
+
+	if(op != 13 && op != 15) dynarecPrvGetReg(x, X86_EAX, Rn);	//MOV & MVN do not use Rn
+
+	switch(op){
+
+		case 3:		//RSB
+			x86_alu_reg_reg(p, X86_ALU_SUB, X86_ECX, X86_EAX);
+			x86_mov_reg_reg(p, X86_EAX, X86_ECX);
+			break;
+
+		case 5:		//ADC
+			x86_bt_mem_imm(p, OFFT_CPSR, 29);
+			x86_alu_reg_reg(p, X86_ALU_ADC, X86_EAX, X86_ECX);
+			break;
+
+		case 6:		//SBC: ARM carry is an inverted x86 borrow
+			x86_bt_mem_imm(p, OFFT_CPSR, 29);
+			x86_cmc(p);
+			x86_alu_reg_reg(p, X86_ALU_SBB, X86_EAX, X86_ECX);
+			break;
+
+		case 7:		//RSC
+			x86_bt_mem_imm(p, OFFT_CPSR, 29);
+			x86_cmc(p);
+			x86_alu_reg_reg(p, X86_ALU_SBB, X86_ECX, X86_EAX);
+			x86_mov_reg_reg(p, X86_EAX, X86_ECX);
+			break;
+
+		case 13:	//MOV
+			x86_mov_reg_reg(p, X86_EAX, X86_ECX);
+			break;
+
+		case 14:	//BIC
+			x86_not(p, X86_ECX);
+			x86_alu_reg_reg(p, X86_ALU_AND, X86_EAX, X86_ECX);
+			break;
+
+		case 15:	//MVN
+			x86_not(p, X86_ECX);
+			x86_mov_reg_reg(p, X86_EAX, X86_ECX);
+			break;
+
+		default:
+			x86_alu_reg_reg(p, aluOps[op], X86_EAX, X86_ECX);
+			break;
+	}
+
+	if(S && !logical){
+
+		x86_setcc(p, (op == 4 || op == 5 || op == 11) ? X86_CC_C : X86_CC_NC, X86_R10);
+		x86_setcc(p, X86_CC_O, X86_R11);
+	}
+	if(store) x86_mov_mem_reg(p, OFFT_REG(Rd), X86_EAX);
+	if(S) dynarecPrvSetFlags(x, logical ? carry : CARRY_R10, !logical);
+
+	dynarecPrvCondEnd(x);
+	return XLAT_OK;
+}
+
+static UInt8 dynarecPrvMul(DynarecXlat* x, UInt32 instr){
+
+	UInt8** p = &x->p;
+	UInt8 Rd = (instr >> 16) & 0x0F, Rn = (instr >> 12) & 0x0F;
+	Boolean A = (instr & 0x00200000UL) != 0;
+
+	if(Rd == 15 || (!A && Rn)) return XLAT_FAIL;
+
+	dynarecPrvCond(x, instr >> 28);
+	dynarecPrvGetReg(x, X86_EAX, (instr >> 8) & 0x0F);
+	dynarecPrvGetReg(x, X86_ECX, instr & 0x0F);
+	x86_imul_reg_reg(p, X86_EAX, X86_ECX);
+	if(A){
+		dynarecPrvGetReg(x, X86_ECX, Rn);
+		x86_alu_reg_reg(p, X86_ALU_ADD, X86_EAX, X86_ECX);
+	}
+	x86_mov_mem_reg(p, OFFT_REG(Rd), X86_EAX);
+	if(instr & 0x00100000UL) dynarecPrvSetFlags(x, CARRY_SAME, false);
+
+	dynarecPrvCondEnd(x);
+	return XLAT_OK;
+}
+
+static void dynarecPrvLoadCall(DynarecXlat* x, UInt8 sz){	//address in ESI, result in EAX. leaves on abort
+
+	x86_mov_reg_imm(&x->p, X86_EDX, sz);
+	x86_mov_reg_imm(&x->p, X86_ECX, dynarecPrvPcNext(x));
+	dynarecPrvCall(x, dynarecPrvLoad);
+	x86_bt64_reg_imm(&x->p, X86_EAX, 32);
+	dynarecPrvExitIf(x, X86_CC_C);
+}
+
+static void dynarecPrvStoreCall(DynarecXlat* x, UInt8 sz){	//address in ESI, value in EDX. leaves on abort
+
+	x86_mov_reg_imm(&x->p, X86_ECX, sz);
+	x86_mov_reg_imm(&x->p, X86_R8, dynarecPrvPcNext(x));
+	dynarecPrvCall(x, dynarecPrvStore);
+	x86_test_reg_reg(&x->p, X86_EAX, X86_EAX);
+	dynarecPrvExitIf(x, X86_CC_Z);
+}
+
+static UInt8 dynarecPrvLoadStoreCommon(DynarecXlat* x, UInt32 instr, UInt8 sz, UInt8 extend, Boolean wb){	//offset in ECX (before U bit is applied)
+
+	UInt8** p = &x->p;
+	UInt8 Rn = (instr >> 16) & 0x0F, Rd = (instr >> 12) & 0x0F;
+	Boolean load = (instr & 0x00100000UL) != 0;
+
+	if(!(instr & 0x00800000UL)) x86_neg(p, X86_ECX);
+
+	dynarecPrvGetReg(x, X86_ESI, Rn);
+	if(wb){
+		x86_mov_reg_reg(p, X86_R12, X86_ESI);
+		x86_alu_reg_reg(p, X86_ALU_ADD, X86_R12, X86_ECX);
+	}
+	if(instr & 0x01000000UL) x86_alu_reg_reg(p, X86_ALU_ADD, X86_ESI, X86_ECX);
+
+	if(load){
+
+		dynarecPrvLoadCall(x, sz);
+		if(extend) x86_movx(p, extend, X86_EAX, X86_EAX);
+		if(Rd == 15){
+
+			x86_mov_reg_reg(p, X86_EDX, X86_EAX);
+			x86_mov_reg_imm(p, X86_ESI, 15);
+			dynarecPrvCall(x, cpuSetReg);
+		}
+		else x86_mov_mem_reg(p, OFFT_REG(Rd), X86_EAX);
+	}
+	else{
+
+		dynarecPrvGetReg(x, X86_EDX, Rd);
+		dynarecPrvStoreCall(x, sz);
+	}
+
+	if(wb) x86_mov_mem_reg(p, OFFT_REG(Rn), X86_R12);
+
+	if(load && Rd == 15){	//we branched
+
+		dynarecPrvExit(x);
+		dynarecPrvCondEnd(x);
+		return dynarecPrvEnd(instr);
+	}
+
+	dynarecPrvCondEnd(x);
+	return XLAT_OK;
+}
+
+static UInt8 dynarecPrvLoadStore(DynarecXlat* x, UInt32 instr){	//LDR/STR/LDRB/STRB
+
+	UInt8 Rn = (instr >> 16) & 0x0F, Rd = (instr >> 12) & 0x0F;
+	Boolean pre = (instr & 0x01000000UL) != 0, wb = !pre || (instr & 0x00200000UL), byte = (instr & 0x00400000UL) != 0;
+
+	if(!pre && (instr & 0x00200000UL)) return XLAT_FAIL;		//LDRT & co
+	if(wb && Rn == 15) return XLAT_FAIL;
+	if(byte && Rd == 15) return XLAT_FAIL;
+
+	if(instr & 0x02000000UL){
+
+		//interpreter skips writeback when the offset is zero, which matters when Rd == Rn
+		if(wb && Rd == Rn && (instr & 0x00100000UL)) return XLAT_FAIL;
+
+		dynarecPrvCond(x, instr >> 28);
+		dynarecPrvGetReg(x, X86_ECX, instr & 0x0F);
+		dynarecPrvImmShift(x, X86_ECX, (instr >> 5) & 3, (instr >> 7) & 0x1F, false);
+	}
+	else{
+
+		if(!(instr & 0xFFF)) wb = false;
+
+		dynarecPrvCond(x, instr >> 28);
+		x86_mov_reg_imm(&x->p, X86_ECX, instr & 0xFFF);
+	}
+
+	return dynarecPrvLoadStoreCommon(x, instr, byte ? 1 : 4, 0, wb);
+}
+
+static UInt8 dynarecPrvLoadStoreMisc(DynarecXlat* x, UInt32 instr){	//LDRH/STRH/LDRSB/LDRSH
+
+	UInt8 Rn = (instr >> 16) & 0x0F, Rd = (instr >> 12) & 0x0F, sz, extend;
+	Boolean pre = (instr & 0x01000000UL) != 0, wb = !pre || (instr & 0x00200000UL), load = (instr & 0x00100000UL) != 0;
+	UInt32 v;
+
+	switch((instr >> 5) & 3){
+
+		case 1:
+			sz = 2;
+			extend = 0;
+			break;
+
+		case 2:
+			sz = 1;
+			extend = X86_MOVSX8;
+			break;
+
+		default:
+			sz = 2;
+			extend = X86_MOVSX16;
+			break;
+	}
+
+	if(!load && extend) return XLAT_FAIL;				//LDRD/STRD
+	if(!pre && (instr & 0x00200000UL)) return XLAT_FAIL;
+	if(wb && Rn == 15) return XLAT_FAIL;
+	if(Rd == 15) return XLAT_FAIL;
+
+	if(instr & 0x00400000UL){
+
+		v = ((instr >> 4) & 0xF0) | (instr & 0x0F);
+		if(!v) wb = false;
+
+		dynarecPrvCond(x, instr >> 28);
+		x86_mov_reg_imm(&x->p, X86_ECX, v);
+	}
+	else{
+
+		if(instr & 0x00000F00UL) return XLAT_FAIL;
+		if(wb && Rd == Rn && load) return XLAT_FAIL;
+
+		dynarecPrvCond(x, instr >> 28);
+		dynarecPrvGetReg(x, X86_ECX, instr & 0x0F);
+	}
+
+	return dynarecPrvLoadStoreCommon(x, instr, sz, extend, wb);
+}
+
+static UInt8 dynarecPrvLoadStoreMulti(DynarecXlat* x, UInt32 instr){	//LDM/STM. EBP holds the original base, R12 the cursor
+
+	UInt8** p = &x->p;
+	UInt8 Rn = (instr >> 16) & 0x0F, i, r, numAborts = 0;
+	Boolean load = (instr & 0x00100000UL) != 0, inc = (instr & 0x00800000UL) != 0, before = (instr & 0x01000000UL) != 0;
+	UInt16 list = instr;
+	UInt8* aborts[16];
+	UInt8* j = NULL;
+
+	if((instr & 0x00400000UL) || !list || Rn == 15) return XLAT_FAIL;
+
+	dynarecPrvCond(x, instr >> 28);
+	x86_mov_reg_mem(p, X86_EBP, OFFT_REG(Rn));
+	x86_mov_reg_reg(p, X86_R12, X86_EBP);
+
+	for(i = 0; i < 16; i++){
+
+		r = inc ? i : 15 - i;
+		if(!(list & (1 << r))) continue;
+
+		if(before) x86_alu_reg_imm(p, inc ? X86_ALU_ADD : X86_ALU_SUB, X86_R12, 4);
+		x86_mov_reg_reg(p, X86_ESI, X86_R12);
+		if(load){
+
+			x86_mov_reg_imm(p, X86_EDX, 4);
+			x86_mov_reg_imm(p, X86_ECX, dynarecPrvPcNext(x));
+			dynarecPrvCall(x, dynarecPrvLoad);
+			x86_bt64_reg_imm(p, X86_EAX, 32);
+			aborts[numAborts++] = x86_jcc(p, X86_CC_C);
+			x86_mov_mem_reg(p, OFFT_REG(r), X86_EAX);
+		}
+		else{
+
+			dynarecPrvGetReg(x, X86_EDX, r);
+			x86_mov_reg_imm(p, X86_ECX, 4);
+			x86_mov_reg_imm(p, X86_R8, dynarecPrvPcNext(x));
+			dynarecPrvCall(x, dynarecPrvStore);
+			x86_test_reg_reg(p, X86_EAX, X86_EAX);
+			aborts[numAborts++] = x86_jcc(p, X86_CC_Z);
+		}
+		if(!before) x86_alu_reg_imm(p, inc ? X86_ALU_ADD : X86_ALU_SUB, X86_R12, 4);
+	}
+
+	if(instr & 0x00200000UL) x86_mov_mem_reg(p, OFFT_REG(Rn), X86_R12);
+
+	if(load && (list & 0x8000)){	//loaded PC, bit 0 picks the state
+
+		x86_mov_reg_mem(p, X86_EAX, OFFT_REG(15));
+		x86_mov_reg_reg(p, X86_EDX, X86_EAX);
+		x86_alu_reg_imm(p, X86_ALU_AND, X86_EDX, 1);
+		x86_shift_imm(p, X86_SHF_SHL, X86_EDX, 5);
+		x86_mov_reg_mem(p, X86_ECX, OFFT_CPSR);
+		x86_alu_reg_imm(p, X86_ALU_AND, X86_ECX, (UInt32)~ARM_SR_T);
+		x86_alu_reg_reg(p, X86_ALU_OR, X86_ECX, X86_EDX);
+		x86_mov_mem_reg(p, OFFT_CPSR, X86_ECX);
+		x86_alu_reg_imm(p, X86_ALU_AND, X86_EAX, (UInt32)~1UL);
+		x86_mov_mem_reg(p, OFFT_REG(15), X86_EAX);
+		dynarecPrvExit(x);
+	}
+	else j = x86_jmp(p);
+
+	//on abort the base is restored if we clobbered it, the exception has already been taken by then
+	for(i = 0; i < numAborts; i++) x86_patch(aborts[i], x->p);
+	if(load && (list & (1 << Rn))) x86_mov_mem_reg(p, OFFT_REG(Rn), X86_EBP);
+	dynarecPrvExit(x);
+	if(j) x86_patch(j, x->p);
+
+	dynarecPrvCondEnd(x);
+	return (load && (list & 0x8000)) ? dynarecPrvEnd(instr) : XLAT_OK;
+}
+
+static UInt8 dynarecPrvBranch(DynarecXlat* x, UInt32 instr){
+
+	UInt32 target = instr & 0x00FFFFFFUL;
+
+	if(target & 0x00800000UL) target |= 0xFF000000UL;
+	target = (target << (x->T ? 1 : 2)) + x->pcVal;
+
+	dynarecPrvCond(x, instr >> 28);
+	if(instr & 0x01000000UL) x86_mov_mem_imm(&x->p, OFFT_REG(14), dynarecPrvPcNext(x));
+	x86_mov_mem_imm(&x->p, OFFT_REG(15), target);
+	dynarecPrvExit(x);
+	dynarecPrvCondEnd(x);
+
+	return dynarecPrvEnd(instr);
+}
+
+static UInt8 dynarecPrvArm(DynarecXlat* x, UInt32 instr){
+
+	if((instr >> 28) == 0x0F){
+
+		if((instr & 0x0D70F000UL) == 0x0550F000UL) return XLAT_OK;	//PLD, nothing to do
+		return XLAT_FAIL;
+	}
+
+	switch((instr >> 25) & 7){
+
+		case 0:
+			if((instr & 0x90) == 0x90){
+
+				if(!(instr & 0x60)) return (instr & 0x0FC000F0UL) == 0x00000090UL ? dynarecPrvMul(x, instr) : XLAT_FAIL;
+				return dynarecPrvLoadStoreMisc(x, instr);
+			}
+			//fallthrough
+		case 1:
+			if((instr & 0x01900000UL) == 0x01000000UL) return XLAT_FAIL;	//misc instrs
+			return dynarecPrvDataProc(x, instr);
+
+		case 3:
+			if(instr & 0x10) return XLAT_FAIL;
+			//fallthrough
+		case 2:
+			return dynarecPrvLoadStore(x, instr);
+
+		case 4:
+			return dynarecPrvLoadStoreMulti(x, instr);
+
+		case 5:
+			return dynarecPrvBranch(x, instr);
+
+		default:
+			return XLAT_FAIL;
+	}
+}
+
+static UInt8 dynarecPrvFallback(DynarecXlat* x, UInt32 instr, Boolean ends){
+
+	x86_mov_reg_imm(&x->p, X86_ESI, instr);
+	x86_mov_reg_imm(&x->p, X86_EDX, x->pc);
+	dynarecPrvCall(x, x->T ? (void*)cpuDynarecExecThumb : (void*)cpuDynarecExecArm);
+
+	if(ends){
+
+		dynarecPrvExit(x);
+		return XLAT_END;
+	}
+
+	//the interpreter may have branched or taken an exception
+	x86_alu_mem_imm(&x->p, X86_ALU_CMP, OFFT_REG(15), dynarecPrvPcNext(x));
+	dynarecPrvExitIf(x, X86_CC_NZ);
+	x86_test_mem_imm(&x->p, OFFT_CPSR, ARM_SR_T);
+	dynarecPrvExitIf(x, x->T ? X86_CC_Z : X86_CC_NZ);
+
+	return XLAT_OK;
+}
+
+static UInt8 dynarecPrvThumb(DynarecXlat* x, UInt16 instrT){
+
+	UInt8** p = &x->p;
+	UInt32 instr, v;
+	Boolean specialPC;
+	UInt8 ret, vD;
+
+	if(cpuDynarecThumbToArm(instrT, &instr, &specialPC)){
+
+		if(specialPC) x->pcVal &= ~3UL;
+		ret = dynarecPrvArm(x, instr);
+		if(ret != XLAT_FAIL) return ret;
+
+		return dynarecPrvFallback(x, instrT, dynarecPrvEndsBlock(instr));
+	}
+
+	switch(instrT >> 11){
+
+		case 0x08:	//hi reg ADD & MOV
+			vD = ((instrT >> 4) & 0x08) | (instrT & 0x07);
+			if(vD == 15 || (instrT & 0x0100)) break;	//PC writes, BX & BLX are left to the interpreter
+
+			dynarecPrvGetReg(x, X86_EAX, (instrT >> 3) & 0x0F);
+			if(!(instrT & 0x0200)){
+				dynarecPrvGetReg(x, X86_ECX, vD);
+				x86_alu_reg_reg(p, X86_ALU_ADD, X86_EAX, X86_ECX);
+			}
+			x86_mov_mem_reg(p, OFFT_REG(vD), X86_EAX);
+			return XLAT_OK;
+
+		case 0x1E:	//BL/BLX prefix
+			v = instrT & 0x7FF;
+			if(v & 0x400) v |= 0xFFFFF800UL;
+			x86_mov_mem_imm(p, OFFT_REG(14), dynarecPrvPcNext(x) + (v << 12));
+			return XLAT_OK;
+
+		case 0x1F:	//BL suffix
+			x86_mov_reg_mem(p, X86_EAX, OFFT_REG(14));
+			x86_alu_reg_imm(p, X86_ALU_ADD, X86_EAX, 2 + ((instrT & 0x7FF) << 1));
+			x86_mov_mem_reg(p, OFFT_REG(15), X86_EAX);
+			x86_mov_mem_imm(p, OFFT_REG(14), dynarecPrvPcNext(x) | 1);
+			dynarecPrvExit(x);
+			return XLAT_END;
+	}
+
+	return dynarecPrvFallback(x, instrT, (instrT & 0xFF00) == 0x4700 || (instrT & 0xF800) == 0xE800 || (instrT & 0xFC87) == 0x4487);	//BX, BLX, PC writes
+}
+
+static void dynarecPrvTrackPage(Dynarec* jit, UInt32 page){
+
+	UInt32 i;
+
+	if(jit->numPages > DYNAREC_MAX_PAGES) return;
+
+	for(i = 0; i < jit->numPages; i++) if(jit->pages[i] == page) return;
+
+	if(jit->numPages == DYNAREC_MAX_PAGES) jit->numPages++;	//too many, from now on we scan on every invalidation
+	else jit->pages[jit->numPages++] = page;
+}
+
+static _INLINE_ UInt32 dynarecPrvHash(UInt32 tag){
+
+	return ((tag >> 1) ^ (tag >> 13)) & (DYNAREC_BLOCKS - 1);
+}
+
+static void dynarecPrvTranslate(Dynarec* jit, DynarecBlock* blk, UInt32 tag, Boolean priv){
+
+	ArmCpu* cpu = jit->cpu;
+	Boolean T = tag & 1;
+	UInt32 pc = tag &~ 1UL, instr = 0, n = 0;
+	UInt16 instrT = 0;
+	UInt8 fsr, ret = XLAT_OK;
+	DynarecXlat x;
+	UInt8* start;
+
+	if(jit->buf + DYNAREC_CODE_SZ - jit->ptr < (Int32)DYNAREC_BLOCK_MAX_SZ + 16){	//out of space: throw it all away
+
+		dynarecInval(jit);
+		jit->ptr = jit->buf;
+	}
+
+	start = (UInt8*)(((uintptr_t)jit->ptr + 15) &~ (uintptr_t)15);
+	x.p = start;
+	x.T = T;
+	x86_push(&x.p, X86_EBX);
+	x86_push(&x.p, X86_R12);
+	x86_push(&x.p, X86_EBP);
+	x86_mov64_reg_reg(&x.p, X86_EBX, X86_EDI);
+
+	do{
+		if(T ? !cpu->memF(cpu, &instrT, pc, 2, false, priv, &fsr) : !cpu->memF(cpu, &instr, pc, 4, false, priv, &fsr)) break;	//interpreter will take the prefetch abort
+
+		x.pc = pc;
+		x.pcVal = pc + (T ? 4 : 8);
+		x.count = ++n;
+
+		if(T) ret = dynarecPrvThumb(&x, instrT);
+		else{
+			ret = dynarecPrvArm(&x, instr);
+			if(ret == XLAT_FAIL) ret = dynarecPrvFallback(&x, instr, dynarecPrvEndsBlock(instr));
+		}
+
+		pc += T ? 2 : 4;
+
+	}while(ret != XLAT_END && n < DYNAREC_MAX_INSTRS && (pc & 0xFFF));
+
+	blk->pc = tag;
+	blk->priv = priv;
+	blk->gen = jit->gen;
+
+	if(!n){	//could not fetch even one instr
+
+		blk->gen = 0;
+		blk->code = NULL;
+		return;
+	}
+
+	if(ret != XLAT_END){
+
+		x86_mov_mem_imm(&x.p, OFFT_REG(15), pc);
+		dynarecPrvExit(&x);
+	}
+
+	blk->code = (DynarecCodeF)start;
+	jit->ptr = x.p;
+	dynarecPrvTrackPage(jit, tag >> 12);
+}
+
+Boolean dynarecInit(Dynarec* jit, ArmCpu* cpu){
+
+	void* mem;
+
+	jit->cpu = cpu;
+	jit->gen = 1;
+	jit->numPages = 0;
+
+	mem = mmap(NULL, DYNAREC_CODE_SZ, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) return false;
+	jit->buf = jit->ptr = mem;
+
+	jit->blocks = emu_alloc(sizeof(DynarecBlock) * DYNAREC_BLOCKS);
+	if(!jit->blocks){
+
+		munmap(jit->buf, DYNAREC_CODE_SZ);
+		return false;
+	}
+
+	return true;
+}
+
+void dynarecDeinit(Dynarec* jit){
+
+	munmap(jit->buf, DYNAREC_CODE_SZ);
+	emu_free(jit->blocks);
+}
+
+UInt32 dynarecRun(Dynarec* jit){
+
+	ArmCpu* cpu = jit->cpu;
+	UInt32 tag = cpu->regs[15];
+	Boolean priv = (cpu->CPSR & ARM_SR_M) != ARM_SR_MODE_USR;
+	DynarecBlock* blk;
+
+	if(cpu->CPSR & ARM_SR_T) tag |= 1;
+
+	blk = jit->blocks + dynarecPrvHash(tag);
+	if(blk->gen != jit->gen || blk->pc != tag || blk->priv != priv) dynarecPrvTranslate(jit, blk, tag, priv);
+
+	return blk->code ? blk->code(cpu) : 0;
+}
+
+void dynarecInval(Dynarec* jit){
+
+	jit->gen++;
+	jit->numPages = 0;
+}
+
+void dynarecInvalAddr(Dynarec* jit, UInt32 addr){
+
+	UInt32 page = addr >> 12, i;
+
+	if(jit->numPages <= DYNAREC_MAX_PAGES){
+
+		for(i = 0; i < jit->numPages && jit->pages[i] != page; i++);
+		if(i == jit->numPages) return;		//no code there
+
+		jit->pages[i] = jit->pages[--jit->numPages];
+	}
+
+	for(i = 0; i < DYNAREC_BLOCKS; i++) if((jit->blocks[i].pc >> 12) == page) jit->blocks[i].gen = 0;
+}
+
+#endif
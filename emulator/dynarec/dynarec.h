@@ -0,0 +1,50 @@
+#ifndef _DYNAREC_H_
+#define _DYNAREC_H_
+
+#include "../helper/types.h"
+
+
+#define DYNAREC_BLOCKS		8192UL		//block lookup table entries, must be a power of 2
+#define DYNAREC_CODE_SZ		(8UL << 20)	//host code buffer size
+#define DYNAREC_MAX_INSTRS	32		//max guest instrs per block
+#define DYNAREC_BLOCK_MAX_SZ	(DYNAREC_MAX_INSTRS * 1024UL)	//no instr translates to more than 1K of host code
+#define DYNAREC_MAX_PAGES	1024		//how many code pages we track for per-address invalidation before giving up and always scanning
+
+
+struct ArmCpu;
+
+typedef UInt32 (*DynarecCodeF)(struct ArmCpu* cpu);	//returns the number of instructions executed
+
+typedef struct{
+
+	UInt32 pc;		//pc of first instr, lower bit set for thumb
+	UInt32 gen;		//only valid if it matches the dynarec's
+	Boolean priv;		//translated from privileged mode?
+	DynarecCodeF code;	//NULL if no code could be produced (interpreter will deal with it)
+
+}DynarecBlock;
+
+typedef struct{
+
+	struct ArmCpu* cpu;
+
+	UInt8* buf;
+	UInt8* ptr;
+	UInt32 gen;
+
+	DynarecBlock* blocks;			//DYNAREC_BLOCKS of them
+
+	UInt32 pages[DYNAREC_MAX_PAGES];	//4K pages we have blocks in, so that dynarecInvalAddr() only scans when it has to
+	UInt16 numPages;			//DYNAREC_MAX_PAGES + 1 means we lost track and always scan
+
+}Dynarec;
+
+
+Boolean dynarecInit(Dynarec* jit, struct ArmCpu* cpu);
+void dynarecDeinit(Dynarec* jit);
+UInt32 dynarecRun(Dynarec* jit);				//returns number of instrs executed, 0 if the interpreter should execute the next one
+void dynarecInval(Dynarec* jit);
+void dynarecInvalAddr(Dynarec* jit, UInt32 addr);
+
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef _X86_64_H_
+#define _X86_64_H_
+
+#include "../helper/types.h"
+
+/*
+	just enough of an x86-64 assembler for the dynarec. all operations are 32-bit unless noted, and all memory
+	operands are [RBX + disp] since that is where the dynarec keeps the ArmCpu pointer
+*/
+
+#define X86_EAX		0
+#define X86_ECX		1
+#define X86_EDX		2
+#define X86_EBX		3
+#define X86_ESP		4
+#define X86_EBP		5
+#define X86_ESI		6
+#define X86_EDI		7
+#define X86_R8		8
+#define X86_R9		9
+#define X86_R10		10
+#define X86_R11		11
+#define X86_R12		12
+
+#define X86_CC_O	0x0
+#define X86_CC_NO	0x1
+#define X86_CC_C	0x2
+#define X86_CC_NC	0x3
+#define X86_CC_Z	0x4
+#define X86_CC_NZ	0x5
+#define X86_CC_S	0x8
+#define X86_CC_NS	0x9
+
+#define X86_ALU_ADD	0	//as encoded in the reg field of 0x81 /x
+#define X86_ALU_OR	1
+#define X86_ALU_ADC	2
+#define X86_ALU_SBB	3
+#define X86_ALU_AND	4
+#define X86_ALU_SUB	5
+#define X86_ALU_XOR	6
+#define X86_ALU_CMP	7
+
+#define X86_SHF_ROR	1	//as encoded in the reg field of 0xC1 /x
+#define X86_SHF_RCR	3
+#define X86_SHF_SHL	4
+#define X86_SHF_SHR	5
+#define X86_SHF_SAR	7
+
+
+static _INLINE_ void x86_byte(UInt8** p, UInt8 v){
+
+	*(*p)++ = v;
+}
+
+static _INLINE_ void x86_dword(UInt8** p, UInt32 v){
+
+	x86_byte(p, v);
+	x86_byte(p, v >> 8);
+	x86_byte(p, v >> 16);
+	x86_byte(p, v >> 24);
+}
+
+static _INLINE_ void x86_rex(UInt8** p, Boolean w, UInt8 reg, UInt8 rm, Boolean byteRm){
+
+	UInt8 rex = 0x40;
+
+	if(w) rex |= 0x08;
+	if(reg & 8) rex |= 0x04;
+	if(rm & 8) rex |= 0x01;
+
+	if(rex != 0x40 || (byteRm && rm >= 4)) x86_byte(p, rex);	//SPL..DIL need an empty REX to not mean AH..BH
+}
+
+static _INLINE_ void x86_modrm_reg(UInt8** p, UInt8 reg, UInt8 rm){
+
+	x86_byte(p, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static _INLINE_ void x86_modrm_mem(UInt8** p, UInt8 reg, Int32 disp){
+
+	if(disp >= -128 && disp < 128){
+
+		x86_byte(p, 0x40 | ((reg & 7) << 3) | X86_EBX);
+		x86_byte(p, disp);
+	}
+	else{
+
+		x86_byte(p, 0x80 | ((reg & 7) << 3) | X86_EBX);
+		x86_dword(p, disp);
+	}
+}
+
+static _INLINE_ void x86_mov_reg_mem(UInt8** p, UInt8 reg, Int32 disp){	//mov reg, [rbx + disp]
+
+	x86_rex(p, false, reg, 0, false);
+	x86_byte(p, 0x8B);
+	x86_modrm_mem(p, reg, disp);
+}
+
+static _INLINE_ void x86_mov_mem_reg(UInt8** p, Int32 disp, UInt8 reg){	//mov [rbx + disp], reg
+
+	x86_rex(p, false, reg, 0, false);
+	x86_byte(p, 0x89);
+	x86_modrm_mem(p, reg, disp);
+}
+
+static _INLINE_ void x86_mov_mem_imm(UInt8** p, Int32 disp, UInt32 imm){	//mov dword [rbx + disp], imm
+
+	x86_byte(p, 0xC7);
+	x86_modrm_mem(p, 0, disp);
+	x86_dword(p, imm);
+}
+
+static _INLINE_ void x86_mov_reg_imm(UInt8** p, UInt8 reg, UInt32 imm){
+
+	x86_rex(p, false, 0, reg, false);
+	x86_byte(p, 0xB8 | (reg & 7));
+	x86_dword(p, imm);
+}
+
+static _INLINE_ void x86_mov_reg_reg(UInt8** p, UInt8 dst, UInt8 src){
+
+	x86_rex(p, false, src, dst, false);
+	x86_byte(p, 0x89);
+	x86_modrm_reg(p, src, dst);
+}
+
+static _INLINE_ void x86_mov64_reg_reg(UInt8** p, UInt8 dst, UInt8 src){
+
+	x86_rex(p, true, src, dst, false);
+	x86_byte(p, 0x89);
+	x86_modrm_reg(p, src, dst);
+}
+
+static _INLINE_ void x86_alu_reg_reg(UInt8** p, UInt8 op, UInt8 dst, UInt8 src){	//op dst, src
+
+	x86_rex(p, false, src, dst, false);
+	x86_byte(p, (op << 3) | 0x01);
+	x86_modrm_reg(p, src, dst);
+}
+
+static _INLINE_ void x86_alu_reg_mem(UInt8** p, UInt8 op, UInt8 reg, Int32 disp){	//op reg, [rbx + disp]
+
+	x86_rex(p, false, reg, 0, false);
+	x86_byte(p, (op << 3) | 0x03);
+	x86_modrm_mem(p, reg, disp);
+}
+
+static _INLINE_ void x86_alu_reg_imm(UInt8** p, UInt8 op, UInt8 reg, UInt32 imm){
+
+	x86_rex(p, false, 0, reg, false);
+	if((Int32)imm >= -128 && (Int32)imm < 128){
+
+		x86_byte(p, 0x83);
+		x86_modrm_reg(p, op, reg);
+		x86_byte(p, imm);
+	}
+	else{
+
+		x86_byte(p, 0x81);
+		x86_modrm_reg(p, op, reg);
+		x86_dword(p, imm);
+	}
+}
+
+static _INLINE_ void x86_alu_mem_imm(UInt8** p, UInt8 op, Int32 disp, UInt32 imm){	//op dword [rbx + disp], imm
+
+	x86_byte(p, 0x81);
+	x86_modrm_mem(p, op, disp);
+	x86_dword(p, imm);
+}
+
+static _INLINE_ void x86_test_reg_reg(UInt8** p, UInt8 a, UInt8 b){
+
+	x86_rex(p, false, b, a, false);
+	x86_byte(p, 0x85);
+	x86_modrm_reg(p, b, a);
+}
+
+static _INLINE_ void x86_test_mem_imm(UInt8** p, Int32 disp, UInt32 imm){	//test dword [rbx + disp], imm
+
+	x86_byte(p, 0xF7);
+	x86_modrm_mem(p, 0, disp);
+	x86_dword(p, imm);
+}
+
+static _INLINE_ void x86_test_reg_imm8(UInt8** p, UInt8 reg, UInt8 imm){	//test reg8, imm
+
+	x86_rex(p, false, 0, reg, true);
+	x86_byte(p, 0xF6);
+	x86_modrm_reg(p, 0, reg);
+	x86_byte(p, imm);
+}
+
+static _INLINE_ void x86_not(UInt8** p, UInt8 reg){
+
+	x86_rex(p, false, 0, reg, false);
+	x86_byte(p, 0xF7);
+	x86_modrm_reg(p, 2, reg);
+}
+
+static _INLINE_ void x86_neg(UInt8** p, UInt8 reg){
+
+	x86_rex(p, false, 0, reg, false);
+	x86_byte(p, 0xF7);
+	x86_modrm_reg(p, 3, reg);
+}
+
+static _INLINE_ void x86_shift_imm(UInt8** p, UInt8 op, UInt8 reg, UInt8 cnt){	//cnt must be 1..31
+
+	x86_rex(p, false, 0, reg, false);
+	x86_byte(p, 0xC1);
+	x86_modrm_reg(p, op, reg);
+	x86_byte(p, cnt);
+}
+
+static _INLINE_ void x86_bt_mem_imm(UInt8** p, Int32 disp, UInt8 bit){	//CF = bit of dword [rbx + disp]
+
+	x86_byte(p, 0x0F);
+	x86_byte(p, 0xBA);
+	x86_modrm_mem(p, 4, disp);
+	x86_byte(p, bit);
+}
+
+static _INLINE_ void x86_bt64_reg_imm(UInt8** p, UInt8 reg, UInt8 bit){	//CF = bit of 64-bit reg
+
+	x86_rex(p, true, 0, reg, false);
+	x86_byte(p, 0x0F);
+	x86_byte(p, 0xBA);
+	x86_modrm_reg(p, 4, reg);
+	x86_byte(p, bit);
+}
+
+static _INLINE_ void x86_cmc(UInt8** p){
+
+	x86_byte(p, 0xF5);
+}
+
+static _INLINE_ void x86_setcc(UInt8** p, UInt8 cc, UInt8 reg){	//reg8 = cc ? 1 : 0
+
+	x86_rex(p, false, 0, reg, true);
+	x86_byte(p, 0x0F);
+	x86_byte(p, 0x90 | cc);
+	x86_modrm_reg(p, 0, reg);
+}
+
+static _INLINE_ void x86_movx(UInt8** p, UInt8 op, UInt8 dst, UInt8 src){	//op is 0xB6 (movzx8), 0xB7 (movzx16), 0xBE (movsx8), 0xBF (movsx16)
+
+	x86_rex(p, false, dst, src, !(op & 1));
+	x86_byte(p, 0x0F);
+	x86_byte(p, op);
+	x86_modrm_reg(p, dst, src);
+}
+
+#define X86_MOVZX8	0xB6
+#define X86_MOVZX16	0xB7
+#define X86_MOVSX8	0xBE
+#define X86_MOVSX16	0xBF
+
+static _INLINE_ void x86_imul_reg_reg(UInt8** p, UInt8 dst, UInt8 src){
+
+	x86_rex(p, false, dst, src, false);
+	x86_byte(p, 0x0F);
+	x86_byte(p, 0xAF);
+	x86_modrm_reg(p, dst, src);
+}
+
+static _INLINE_ UInt8* x86_jcc(UInt8** p, UInt8 cc){	//returns where to patch in the destination
+
+	x86_byte(p, 0x0F);
+	x86_byte(p, 0x80 | cc);
+	x86_dword(p, 0);
+
+	return *p - 4;
+}
+
+static _INLINE_ UInt8* x86_jcc8(UInt8** p, UInt8 cc){	//short version of the above
+
+	x86_byte(p, 0x70 | cc);
+	x86_byte(p, 0);
+
+	return *p - 1;
+}
+
+static _INLINE_ UInt8* x86_jmp(UInt8** p){	//returns where to patch in the destination
+
+	x86_byte(p, 0xE9);
+	x86_dword(p, 0);
+
+	return *p - 4;
+}
+
+static _INLINE_ void x86_patch(UInt8* at, UInt8* dst){
+
+	UInt32 rel = dst - (at + 4);
+
+	at[0] = rel;
+	at[1] = rel >> 8;
+	at[2] = rel >> 16;
+	at[3] = rel >> 24;
+}
+
+static _INLINE_ void x86_patch8(UInt8* at, UInt8* dst){
+
+	*at = dst - (at + 1);
+}
+
+static _INLINE_ void x86_call(UInt8** p, void* func){	//clobbers RAX
+
+	uintptr_t v = (uintptr_t)func;
+
+	x86_byte(p, 0x48);		//mov rax, imm64
+	x86_byte(p, 0xB8);
+	x86_dword(p, v);
+	x86_dword(p, v >> 32);
+	x86_byte(p, 0xFF);		//call rax
+	x86_byte(p, 0xD0);
+}
+
+static _INLINE_ void x86_push(UInt8** p, UInt8 reg){
+
+	x86_rex(p, false, 0, reg, false);
+	x86_byte(p, 0x50 | (reg & 7));
+}
+
+static _INLINE_ void x86_pop(UInt8** p, UInt8 reg){
+
+	x86_rex(p, false, 0, reg, false);
+	x86_byte(p, 0x58 | (reg & 7));
+}
+
+static _INLINE_ void x86_ret(UInt8** p){
+
+	x86_byte(p, 0xC3);
+}
+
+#endif
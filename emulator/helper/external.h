@@ -1,7 +1,13 @@
 #ifndef EXTERNAL_H_
 #define EXTERNAL_H_
 
+#include "types.h"
+#include "../math/math64.h"
+
 UInt32 rtcCurTime(void);
+UInt64 hostClockNs(void);	//monotonic, used to pace guest time
+void hostIdle(UInt64 ns);	//sleep for up to ns, less if there is console input
+Boolean hostConsoleReady(void);	//console input came in since the last call. called very often, a fine place to flush output too
 void* emu_alloc(UInt32 size);
 void emu_free(void* ptr);
 
@@ -0,0 +1,47 @@
+#ifndef _SNAP_H_
+#define _SNAP_H_
+
+#include "types.h"
+
+/*
+	machine snapshots. each module has a fooSnap() that walks its state, the same function saves it and restores it
+	(snap->load says which) so the two can never disagree on the layout. only state goes in, never pointers or
+	callbacks, those are set up by the usual init before a restore. after a restore the module redoes whatever it
+	derives from that state. a stream has no layout info in it, its version says what wrote it
+*/
+
+typedef Boolean (*SnapIoF)(void* userData, void* buf, UInt32 len, Boolean load);	//move len bytes to/from the stream
+
+typedef struct{
+	
+	SnapIoF ioF;
+	void* userData;
+	Boolean load;
+	Boolean ok;		//false after the first failure, everything after that does nothing
+	
+}Snap;
+
+static _INLINE_ void snapInit(Snap* s, SnapIoF ioF, void* userData, Boolean load){
+	
+	s->ioF = ioF;
+	s->userData = userData;
+	s->load = load;
+	s->ok = true;
+}
+
+static _INLINE_ void snapBytes(Snap* s, void* buf, UInt32 len){
+	
+	if(s->ok && !s->ioF(s->userData, buf, len, s->load)) s->ok = false;
+}
+
+static _INLINE_ UInt32 snapU32(Snap* s, UInt32 val){	//for bitfields and such that have no address: "x = snapU32(s, x);"
+	
+	snapBytes(s, &val, sizeof(val));
+	
+	return val;
+}
+
+#define snapVal(s, v)	snapBytes((s), &(v), sizeof(v))
+
+
+#endif
@@ -1,5 +1,7 @@
 #include "SoC/SoC.h"
+#include "helper/external.h"
 #include <sys/time.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,8 +10,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <termios.h>
+#include <pthread.h>
+#include <errno.h>
 
 #define off64_t __off64_t
 unsigned char* readFile(const char* name, UInt32* lenP){
@@ -62,30 +68,110 @@ unsigned char* readFile(const char* name, UInt32* lenP){
 
 
 
+SoC soc;
+
+#define CON_RING_SZ	256	//power of two
+
+/*
+	console input is read by its own thread, so the emulator never makes a syscall to find out there is none. it goes
+	through a single producer single consumer ring, and each arrival raises conArrived and pokes conWakeFds so that
+	hostConsoleReady() and hostIdle() notice
+*/
+
+static UInt8 conRing[CON_RING_SZ];
+static UInt32 conHead = 0;		//written only by the reader thread
+static UInt32 conTail = 0;		//written only by readchar()
+static int conArrived = 0;
+static int conWakeFds[2];
+
+#define CON_OUT_SZ		4096
+#define CON_OUT_MAX_AGE		10000000ULL	//ns, longest output waits in conOut
+#define CON_OUT_LINE_GAP	2000000ULL	//ns, a newline this long after the last flush is not part of a burst, flush it
+
+/*
+	console output is collected in conOut and written out in one go when it fills up, when the guest goes idle, on a
+	newline that is not part of a burst, or once the oldest byte in it is CON_OUT_MAX_AGE old (hostConsoleReady()
+	checks that). a boot log scrolling by then costs a handful of syscalls, not one per char
+*/
+
+static char conOut[CON_OUT_SZ];
+static UInt32 conOutLen = 0;
+static UInt64 conOutSince;		//when the oldest byte in conOut came in
+static UInt64 conOutFlushed = 0;	//when we last flushed
+
 static int ctlCSeen = 0;
+static volatile int statsWanted = 0;
+
+static const char* snapPath = NULL;	//-S, where to save a snapshot
+static const char* snapMarker = "login:";	//-T, save once the console has printed this
+static UInt32 snapMatched = 0;		//how much of snapMarker we just saw, all of it once we have saved
+static volatile int snapWanted = 0;
+static const char* forkDir = NULL;	//-F, the fork server keeps its instances' overlays and consoles here
+
+static void conFlush(void){
+	
+	UInt32 done = 0;
+	int i;
+	
+	if(!conOutLen) return;
+	
+	while(done < conOutLen){
+		
+		i = write(1, conOut + done, conOutLen - done);
+		if(i <= 0) break;	//nowhere to put it, drop it
+		done += i;
+	}
+	conOutLen = 0;
+	conOutFlushed = hostClockNs();
+}
+
+static void printStats(void){
+	
+	conFlush();
+	fprintf(stderr, "\r\n[stats] tlb misses: %lu, data tlb misses: %lu\r\n", (unsigned long)soc.mmu.tlbMisses, (unsigned long)soc.mmu.dtlbMisses);
+}
+
+static void conWake(void){		//also called from signal handlers, keep it safe for that
+	
+	char c = 0;
+	
+	__atomic_store_n(&conArrived, 1, __ATOMIC_RELEASE);
+	if(write(conWakeFds[1], &c, 1) < 0){
+		
+		//pipe full, a wakeup is pending already
+	}
+}
+
+static void* conReaderThread(_UNUSED_ void* arg){
+	
+	UInt32 head = 0;
+	UInt8 c;
+	
+	while(read(0, &c, 1) == 1){
+		
+		while(head - __atomic_load_n(&conTail, __ATOMIC_ACQUIRE) == CON_RING_SZ) usleep(1000);	//guest is not reading, wait for room
+		
+		conRing[head % CON_RING_SZ] = c;
+		__atomic_store_n(&conHead, ++head, __ATOMIC_RELEASE);
+		conWake();
+	}
+	
+	return NULL;	//eof or error, nothing more will come
+}
 
 static int readchar(void){
 	
-	struct timeval tv;
-	fd_set set;
-	char c;
-	int i, ret = CHAR_NONE;
+	int ret = CHAR_NONE;
 	
 	if(ctlCSeen){
 		ctlCSeen = 0;
 		return 0x03;
 	}
 	
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
-	
-	FD_ZERO(&set);
-	FD_SET(0, &set);
-	
-	i = select(1, &set, NULL, NULL, &tv);
-	if(i == 1 && 1 == read(0, &c, 1)){
+	if(conTail != __atomic_load_n(&conHead, __ATOMIC_ACQUIRE)){
 		
-		ret = c;
+		ret = conRing[conTail % CON_RING_SZ];
+		__atomic_store_n(&conTail, conTail + 1, __ATOMIC_RELEASE);	//the uart keeps coming back for more while it is receiving
 	}
 
 	return ret;
@@ -93,75 +179,778 @@ static int readchar(void){
 
 static void writechar(int chr){
 
+	UInt64 now;
+	
+	if(conOutLen > CON_OUT_SZ - 32) conFlush();	//room for the longest thing we put in there
+	if(!conOutLen) conOutSince = hostClockNs();
+	
 	if(!(chr & 0xFF00)){
 		
-		printf("%c", chr);
+		conOut[conOutLen++] = chr;
+		
+		if((snapPath || forkDir) && snapMarker[snapMatched]){		//guest output is tame enough that we need not backtrack further than this
+			
+			if(chr == snapMarker[snapMatched]) snapMatched++;
+			else snapMatched = chr == snapMarker[0];
+			if(!snapMarker[snapMatched]) snapWanted = 1;
+		}
+		
+		if(chr == '\n'){
+			
+			now = hostClockNs();
+			if(now - conOutFlushed > CON_OUT_LINE_GAP) conFlush();
+		}
 	}
 	else{
-		printf("<<~~ EC_0x%x ~~>>", chr);
+		conOutLen += sprintf(conOut + conOutLen, "<<~~ EC_0x%x ~~>>", chr);
 	}
-	fflush(stdout);	
 }
 
 void ctl_cHandler(_UNUSED_ int v){	//handle SIGTERM      
 	
 //	exit(-1);
 	ctlCSeen = 1;
+	conWake();
 }
 
-int rootOps(void* userData, UInt32 sector, void* buf, UInt8 op){
+void statsHandler(_UNUSED_ int v){	//SIGUSR1 asks for emulator stats on stderr
 	
-	FILE* root = userData;
-	int i;
+	statsWanted = 1;
+}
+
+void snapHandler(_UNUSED_ int v){	//SIGUSR2 asks for a snapshot, or for the fork server to start serving
+	
+	snapWanted = 1;
+	conWake();
+}
+
+static Boolean snapPrvIo(void* userData, void* buf, UInt32 len, Boolean load){
+	
+	FILE* f = userData;
+	
+	return (load ? fread(buf, 1, len, f) : fwrite(buf, 1, len, f)) == len;
+}
+
+static void snapPrvSave(void){
+	
+	Boolean ok;
+	FILE* f;
+	
+	conFlush();
+	f = fopen(snapPath, "wb");
+	ok = f && socSave(&soc, snapPrvIo, f);
+	if(f && fclose(f)) ok = false;
+	
+	//the guest's disk has to be as it is now when this is restored, get it all out of our buffers
+	if(ok && soc.blkF(soc.blkD, 0, NULL, 0, BLK_OP_FLUSH) <= 0) ok = false;
+	
+	if(ok) fprintf(stderr, "\r\n[snap] saved to %s\r\n", snapPath);
+	else fprintf(stderr, "\r\n[snap] cannot save to %s\r\n", snapPath);
+}
+
+static Boolean snapPrvRestore(const char* path){
+	
+	Boolean ok;
+	FILE* f;
+	
+	f = fopen(path, "rb");
+	if(!f) return false;
+	ok = socRestore(&soc, snapPrvIo, f);
+	fclose(f);
+	
+	return ok;
+}
+
+static Boolean rootPrvXfer(int fd, struct iovec* iov, int n, off_t pos, Boolean write){	//whole vector or fail, short transfers get resumed
+	
+	ssize_t r;
+	
+	while(n){
+		
+		r = write ? pwritev(fd, iov, n, pos) : preadv(fd, iov, n, pos);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		
+		pos += r;
+		while(n && (size_t)r >= iov->iov_len){
+			
+			r -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n){
+			
+			iov->iov_base = (char*)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+	return true;
+}
+
+/*
+	async disk I/O is done by a thread of its own, one op at a time (the SoC never queues more). a backend's
+	BLK_OP_ASYNC goes to blkPrvQueue(), which fills in blkReq and kicks the thread. it calls the backend with the
+	plain op, sets blkDone and pokes conWakeFds in case the emulator is idle waiting for it. BLK_OP_POLL then
+	collects it with blkPrvPoll(). the guest keeps running all the while
+*/
+
+static struct{
+	
+	blockOp f;
+	void* data;
+	UInt32 sector;
+	BlkSeg segs[BLK_MAX_SEGS];
+	UInt32 n;
+	UInt8 op;
+	Boolean ok;
+	
+}blkReq;
+static pthread_mutex_t blkLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blkCond = PTHREAD_COND_INITIALIZER;
+static int blkQueued = 0;		//under blkLock
+static int blkDone = 0;
+
+static void* blkWorkerThread(_UNUSED_ void* arg){
+	
+	char c = 0;
+	
+	pthread_mutex_lock(&blkLock);
+	while(1){
+		
+		while(!blkQueued) pthread_cond_wait(&blkCond, &blkLock);
+		pthread_mutex_unlock(&blkLock);
+		
+		blkReq.ok = blkReq.f(blkReq.data, blkReq.sector, blkReq.segs, blkReq.n, blkReq.op);
+		
+		pthread_mutex_lock(&blkLock);
+		blkQueued = 0;
+		__atomic_store_n(&blkDone, 1, __ATOMIC_RELEASE);
+		if(write(conWakeFds[1], &c, 1) < 0){
+			
+			//pipe full, a wakeup is pending already
+		}
+	}
+	
+	return NULL;
+}
+
+static int blkPrvQueue(blockOp f, void* data, UInt32 sector, const BlkSeg* segs, UInt32 numSegs, UInt8 op){
+	
+	UInt32 i;
+	
+	if(numSegs > BLK_MAX_SEGS) return false;
+	for(i = 0; i < numSegs; i++) blkReq.segs[i] = segs[i];
+	blkReq.f = f;
+	blkReq.data = data;
+	blkReq.sector = sector;
+	blkReq.n = numSegs;
+	blkReq.op = op & ~BLK_OP_ASYNC;
+	
+	pthread_mutex_lock(&blkLock);
+	blkQueued = 1;
+	pthread_cond_signal(&blkCond);
+	pthread_mutex_unlock(&blkLock);
+	return 1;
+}
+
+static int blkPrvPoll(const BlkSeg* segs){
+	
+	if(!__atomic_exchange_n(&blkDone, 0, __ATOMIC_ACQUIRE)) return 0;
+	*(Boolean*)segs->ptr = blkReq.ok;
+	return 1;
+}
+
+/*
+	small writes to the image are held back in rootWb instead of costing a syscall each. they go out sorted, runs of
+	adjacent sectors merged into one pwritev, when it fills up, on a guest flush (followed by fdatasync), at exit,
+	or once the oldest is ROOT_WB_MAX_AGE old (hostConsoleReady() checks that, so a killed emulator loses little).
+	reads get patched from it. big writes go straight out, updating any copies held here so those stay current.
+	rootWbLock is needed as the async thread uses it too
+*/
+
+#define ROOT_WB_SECS		2048	//sectors held at most
+#define ROOT_WB_HASH		4096	//power of two, at least twice ROOT_WB_SECS
+#define ROOT_WB_DIRECT		128	//writes of this many sectors or more skip it
+#define ROOT_WB_MAX_AGE		500000000ULL	//ns
+#define ROOT_WB_IOVS		1024	//most pwritev takes at once (IOV_MAX on linux)
+
+static struct{
+	
+	int fd;
+	UInt32 num;
+	UInt64 since;		//when the oldest went in
+	Boolean failed;		//a write-back went wrong since the last flush
+	UInt32 sec[ROOT_WB_SECS];
+	UInt16 hash[ROOT_WB_HASH];	//1 + index into sec & data, 0 if empty
+	UInt16 order[ROOT_WB_SECS];
+	UInt8 data[ROOT_WB_SECS][BLK_DEV_BLK_SZ];
+	
+}rootWb;
+static pthread_mutex_t rootWbLock = PTHREAD_MUTEX_INITIALIZER;
+
+static UInt8* rootPrvWbFind(UInt32 sec, Boolean add){
+	
+	UInt32 h = (sec * 2654435761UL) & (ROOT_WB_HASH - 1);
+	
+	while(rootWb.hash[h]){
+		
+		if(rootWb.sec[rootWb.hash[h] - 1] == sec) return rootWb.data[rootWb.hash[h] - 1];
+		h = (h + 1) & (ROOT_WB_HASH - 1);
+	}
+	if(!add) return NULL;
+	
+	if(!rootWb.num) rootWb.since = hostClockNs();
+	rootWb.sec[rootWb.num] = sec;
+	rootWb.hash[h] = ++rootWb.num;
+	
+	return rootWb.data[rootWb.num - 1];
+}
+
+static int rootPrvWbCmp(const void* a, const void* b){
+	
+	UInt32 sa = rootWb.sec[*(const UInt16*)a], sb = rootWb.sec[*(const UInt16*)b];
+	
+	return sa < sb ? -1 : sa > sb;
+}
+
+static void rootPrvWbOut(void){		//under rootWbLock
+	
+	struct iovec iov[ROOT_WB_IOVS];
+	UInt32 i, n;
+	
+	for(i = 0; i < rootWb.num; i++) rootWb.order[i] = i;
+	qsort(rootWb.order, rootWb.num, sizeof(*rootWb.order), rootPrvWbCmp);
+	
+	for(i = 0; i < rootWb.num; i += n){
+		
+		for(n = 0; i + n < rootWb.num && n < sizeof(iov) / sizeof(*iov); n++){
+			
+			if(n && rootWb.sec[rootWb.order[i + n]] != rootWb.sec[rootWb.order[i]] + n) break;
+			iov[n].iov_base = rootWb.data[rootWb.order[i + n]];
+			iov[n].iov_len = BLK_DEV_BLK_SZ;
+		}
+		if(!rootPrvXfer(rootWb.fd, iov, n, (off_t)rootWb.sec[rootWb.order[i]] * (off_t)BLK_DEV_BLK_SZ, true)) rootWb.failed = true;
+	}
+	
+	rootWb.num = 0;
+	memset(rootWb.hash, 0, sizeof(rootWb.hash));
+}
+
+static void rootPrvWbCopy(UInt32 sector, const BlkSeg* segs, UInt32 numSegs, Boolean write, Boolean add){	//under rootWbLock
+	
+	UInt32 i, j;
+	UInt8 *p, *c;
+	
+	for(i = 0; i < numSegs; i++){
+		
+		for(j = 0, p = segs[i].ptr; j < segs[i].len; j += BLK_DEV_BLK_SZ, p += BLK_DEV_BLK_SZ, sector++){
+			
+			c = rootPrvWbFind(sector, add);
+			if(!c) continue;
+			
+			if(write) memcpy(c, p, BLK_DEV_BLK_SZ);
+			else memcpy(p, c, BLK_DEV_BLK_SZ);
+		}
+	}
+}
+
+static void rootPrvWbAge(void){
+	
+	if(!__atomic_load_n(&rootWb.num, __ATOMIC_RELAXED) || pthread_mutex_trylock(&rootWbLock)) return;	//async thread is busy with it, next time
+	
+	if(rootWb.num && hostClockNs() - rootWb.since > ROOT_WB_MAX_AGE) rootPrvWbOut();
+	pthread_mutex_unlock(&rootWbLock);
+}
+
+static Boolean rootPrvWrite(int root, UInt32 sector, const BlkSeg* segs, UInt32 numSegs, struct iovec* iov){
+	
+	UInt32 i, num = 0;
+	Boolean ret = true;
+	
+	for(i = 0; i < numSegs; i++) num += segs[i].len / BLK_DEV_BLK_SZ;
+	
+	pthread_mutex_lock(&rootWbLock);
+	if(num < ROOT_WB_DIRECT){
+		
+		if(rootWb.num + num > ROOT_WB_SECS) rootPrvWbOut();
+		rootWb.fd = root;
+		rootPrvWbCopy(sector, segs, numSegs, true, true);
+	}
+	else{
+		
+		if(rootWb.num) rootPrvWbCopy(sector, segs, numSegs, true, false);
+		ret = rootPrvXfer(root, iov, numSegs, (off_t)sector * (off_t)BLK_DEV_BLK_SZ, true);
+	}
+	pthread_mutex_unlock(&rootWbLock);
+	
+	return ret;
+}
+
+int rootOps(void* userData, UInt32 sector, const BlkSeg* segs, UInt32 numSegs, UInt8 op){
+	
+	int root = *(int*)userData;
+	struct iovec iov[BLK_MAX_SEGS];
+	Boolean ret;
+	off_t sz;
+	UInt32 i;
 	
 	switch(op){
 		case BLK_OP_SIZE:
 			
 			if(sector == 0){	//num blocks
 				
-				if(root){
+				if(root >= 0){
 					
-					i = fseeko64(root, 0, SEEK_END);
-					if(i) return false;
+					sz = lseek(root, 0, SEEK_END);
+					if(sz < 0) return false;
 					
-					 *(unsigned long*)buf = (off64_t)ftello64(root) / (off64_t)BLK_DEV_BLK_SZ;
+					 *(unsigned long*)segs->ptr = sz / (off_t)BLK_DEV_BLK_SZ;
 				}
 				else{
 					
-					*(unsigned long*)buf = 0;
+					*(unsigned long*)segs->ptr = 0;
 				}
 			}
 			else if(sector == 1){	//block size
 				
-				*(unsigned long*)buf = BLK_DEV_BLK_SZ;
+				*(unsigned long*)segs->ptr = BLK_DEV_BLK_SZ;
 			}
 			else return 0;
 			return 1;
 		
 		case BLK_OP_READ:
+		case BLK_OP_WRITE:
 			
-			i = fseeko64(root, (off64_t)sector * (off64_t)BLK_DEV_BLK_SZ, SEEK_SET);
-			if(i) return false;
-			return fread(buf, 1, BLK_DEV_BLK_SZ, root) == BLK_DEV_BLK_SZ;
+			if(numSegs > BLK_MAX_SEGS) return false;
+			for(i = 0; i < numSegs; i++){
+				
+				iov[i].iov_base = segs[i].ptr;
+				iov[i].iov_len = segs[i].len;
+			}
+			if(op == BLK_OP_WRITE) return rootPrvWrite(root, sector, segs, numSegs, iov);
+			
+			//the file and what we hold back have to be looked at as one, or the held copy could be written out and dropped
+			//in between and we would return what the file had before it
+			pthread_mutex_lock(&rootWbLock);
+			ret = rootPrvXfer(root, iov, numSegs, (off_t)sector * (off_t)BLK_DEV_BLK_SZ, false);
+			if(ret && rootWb.num) rootPrvWbCopy(sector, segs, numSegs, false, false);
+			pthread_mutex_unlock(&rootWbLock);
+			return ret;
 		
-		case BLK_OP_WRITE:
+		case BLK_OP_FLUSH:
+			
+			pthread_mutex_lock(&rootWbLock);
+			rootPrvWbOut();
+			ret = !rootWb.failed && !fdatasync(root);
+			rootWb.failed = false;
+			pthread_mutex_unlock(&rootWbLock);
+			return ret;
+		
+		case BLK_OP_READ | BLK_OP_ASYNC:
+		case BLK_OP_WRITE | BLK_OP_ASYNC:
+		case BLK_OP_FLUSH | BLK_OP_ASYNC:
 			
-			i = fseeko64(root, (off64_t)sector * (off64_t)BLK_DEV_BLK_SZ, SEEK_SET);
-			if(i) return false;
-			return fwrite(buf, 1, BLK_DEV_BLK_SZ, root) == BLK_DEV_BLK_SZ;
+			return blkPrvQueue(rootOps, userData, sector, segs, numSegs, op);
+		
+		case BLK_OP_POLL:
+			
+			return blkPrvPoll(segs);
 	}
 	return 0;	
 }
 
-SoC soc;
+/*
+	with -m the whole disk image is mapped in and reads & writes are just copies, no syscalls at all. the host's page
+	cache does the caching and writes get to the file whenever it gets to them (or at exit). no async ops, a copy is
+	about as quick as queueing one would be. images we cannot map (too big for the address space) get file I/O
+*/
+
+typedef struct{
+	
+	UInt8* map;
+	UInt64 sz;		//bytes
+	
+}RootMap;
+
+static Boolean rootPrvMap(RootMap* m, int fd){
+	
+	struct stat st;
+	
+	if(fstat(fd, &st) || !st.st_size || (UInt64)(size_t)st.st_size != (UInt64)st.st_size) return false;
+	
+	m->sz = st.st_size;
+	m->map = mmap(NULL, m->sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	
+	return m->map != MAP_FAILED;
+}
+
+int rootMapOps(void* userData, UInt32 sector, const BlkSeg* segs, UInt32 numSegs, UInt8 op){
+	
+	RootMap* m = userData;
+	UInt64 pos = (UInt64)sector * BLK_DEV_BLK_SZ;
+	UInt32 i;
+	
+	switch(op){
+		case BLK_OP_SIZE:
+			
+			if(sector == 0) *(unsigned long*)segs->ptr = m->sz / BLK_DEV_BLK_SZ;		//num blocks
+			else if(sector == 1) *(unsigned long*)segs->ptr = BLK_DEV_BLK_SZ;	//block size
+			else return 0;
+			return 1;
+		
+		case BLK_OP_READ:
+		case BLK_OP_WRITE:
+			
+			for(i = 0; i < numSegs; pos += segs[i++].len){
+				
+				if(pos > m->sz || m->sz - pos < segs[i].len) return false;
+				
+				if(op == BLK_OP_WRITE) memcpy(m->map + pos, segs[i].ptr, segs[i].len);
+				else memcpy(segs[i].ptr, m->map + pos, segs[i].len);
+			}
+			return 1;
+		
+		case BLK_OP_FLUSH:
+			
+			return !msync(m->map, m->sz, MS_SYNC);
+	}
+	return 0;
+}
+
+/*
+	copy-on-write overlay (-o): the base image is only ever read, everything written goes to the overlay file. that
+	has a header, then the cluster map (one UInt32 per COW_CLUSTER_SZ of the base, 0 if the cluster is still in the
+	base, else 1 + its index in the data area), then the data area of clusters in the order they were first written.
+	a new overlay is just the header and a sparse zero map, so any number of them can start off the same base at once
+	and each takes up as much disk as its guest dirtied. the map is kept in memory and each entry written through as
+	its cluster gets copied up. the file is in host byte order
+*/
+
+#define COW_MAGIC		"uARMcow1"
+#define COW_CLUSTER_SZ		65536UL
+
+typedef struct{
+	
+	char magic[8];
+	UInt32 clusterSz;
+	UInt32 numClusters;
+	UInt64 baseSz;		//bytes, an overlay only goes with the base it was made for
+	
+}CowHdr;
+
+typedef struct{
+	
+	int base;
+	int ovl;
+	UInt64 sz;
+	UInt32 numClusters;
+	UInt32 numAlloc;	//clusters in the data area
+	UInt32* map;
+	off_t dataOff;
+	UInt8 buf[COW_CLUSTER_SZ];	//for filling in a cluster being copied up
+	
+}RootCow;
+
+static Boolean rootPrvRw(int fd, void* buf, UInt32 len, off_t pos, Boolean write){
+	
+	struct iovec iov;
+	
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	
+	return rootPrvXfer(fd, &iov, 1, pos, write);
+}
+
+static Boolean rootPrvCowOpen(RootCow* c, int base, const char* path){
+	
+	CowHdr hdr;
+	struct stat st;
+	UInt32 i;
+	
+	c->base = base;
+	if(fstat(base, &st)) return false;
+	c->sz = st.st_size;
+	c->numClusters = (c->sz + COW_CLUSTER_SZ - 1) / COW_CLUSTER_SZ;
+	c->dataOff = (sizeof(CowHdr) + (off_t)c->numClusters * sizeof(UInt32) + COW_CLUSTER_SZ - 1) / COW_CLUSTER_SZ * COW_CLUSTER_SZ;
+	c->numAlloc = 0;
+	
+	c->ovl = open(path, O_RDWR | O_CREAT, 0644);
+	if(c->ovl < 0 || fstat(c->ovl, &st)) return false;
+	
+	c->map = calloc(c->numClusters, sizeof(UInt32));
+	if(!c->map) return false;
+	
+	if(!st.st_size){		//new one
+		
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, COW_MAGIC, sizeof(hdr.magic));
+		hdr.clusterSz = COW_CLUSTER_SZ;
+		hdr.numClusters = c->numClusters;
+		hdr.baseSz = c->sz;
+		
+		return !ftruncate(c->ovl, c->dataOff) && rootPrvRw(c->ovl, &hdr, sizeof(hdr), 0, true);
+	}
+	
+	if(!rootPrvRw(c->ovl, &hdr, sizeof(hdr), 0, false) || memcmp(hdr.magic, COW_MAGIC, sizeof(hdr.magic))) return false;
+	if(hdr.clusterSz != COW_CLUSTER_SZ || hdr.numClusters != c->numClusters || hdr.baseSz != c->sz) return false;
+	if(!rootPrvRw(c->ovl, c->map, c->numClusters * sizeof(UInt32), sizeof(CowHdr), false)) return false;
+	
+	for(i = 0; i < c->numClusters; i++) if(c->map[i] > c->numAlloc) c->numAlloc = c->map[i];
+	
+	return true;
+}
+
+static Boolean rootPrvCowPiece(RootCow* c, UInt64 pos, UInt8* buf, UInt32 len, Boolean write){	//never crosses a cluster
+	
+	UInt32 cl = pos / COW_CLUSTER_SZ, off = pos % COW_CLUSTER_SZ, have;
+	
+	if(!c->map[cl] && !write) return rootPrvRw(c->base, buf, len, pos, false);
+	
+	if(!c->map[cl]){		//first write here, the cluster moves to the overlay. what we are not writing comes from the base
+		
+		if(len != COW_CLUSTER_SZ){
+			
+			have = c->sz - (UInt64)cl * COW_CLUSTER_SZ;
+			if(have > COW_CLUSTER_SZ) have = COW_CLUSTER_SZ;
+			if(!rootPrvRw(c->base, c->buf, have, (off_t)cl * COW_CLUSTER_SZ, false)) return false;
+			memset(c->buf + have, 0, COW_CLUSTER_SZ - have);
+		}
+		memcpy(c->buf + off, buf, len);
+		
+		if(!rootPrvRw(c->ovl, c->buf, COW_CLUSTER_SZ, c->dataOff + (off_t)c->numAlloc * COW_CLUSTER_SZ, true)) return false;
+		c->map[cl] = ++c->numAlloc;
+		
+		return rootPrvRw(c->ovl, c->map + cl, sizeof(UInt32), sizeof(CowHdr) + (off_t)cl * sizeof(UInt32), true);	//data first, so a crash never leaves the map pointing at junk
+	}
+	
+	return rootPrvRw(c->ovl, buf, len, c->dataOff + (off_t)(c->map[cl] - 1) * COW_CLUSTER_SZ + off, write);
+}
+
+int rootCowOps(void* userData, UInt32 sector, const BlkSeg* segs, UInt32 numSegs, UInt8 op){
+	
+	RootCow* c = userData;
+	UInt64 pos = (UInt64)sector * BLK_DEV_BLK_SZ;
+	UInt32 i, done, now;
+	
+	switch(op){
+		case BLK_OP_SIZE:
+			
+			if(sector == 0) *(unsigned long*)segs->ptr = c->sz / BLK_DEV_BLK_SZ;		//num blocks
+			else if(sector == 1) *(unsigned long*)segs->ptr = BLK_DEV_BLK_SZ;	//block size
+			else return 0;
+			return 1;
+		
+		case BLK_OP_READ:
+		case BLK_OP_WRITE:
+			
+			for(i = 0; i < numSegs; i++){
+				
+				if(pos > c->sz || c->sz - pos < segs[i].len) return false;
+				
+				for(done = 0; done < segs[i].len; done += now, pos += now){
+					
+					now = COW_CLUSTER_SZ - pos % COW_CLUSTER_SZ;
+					if(now > segs[i].len - done) now = segs[i].len - done;
+					
+					if(!rootPrvCowPiece(c, pos, (UInt8*)segs[i].ptr + done, now, op == BLK_OP_WRITE)) return false;
+				}
+			}
+			return 1;
+		
+		case BLK_OP_FLUSH:
+			
+			return !fdatasync(c->ovl);
+		
+		case BLK_OP_READ | BLK_OP_ASYNC:
+		case BLK_OP_WRITE | BLK_OP_ASYNC:
+		case BLK_OP_FLUSH | BLK_OP_ASYNC:
+			
+			return blkPrvQueue(rootCowOps, userData, sector, segs, numSegs, op);
+		
+		case BLK_OP_POLL:
+			
+			return blkPrvPoll(segs);
+	}
+	return 0;
+}
+
+static void hostPrvStart(Boolean console){	//wakeup pipe and our threads
+	
+	pthread_t conThread, blkThread;
+	sigset_t sigs, oldSigs;
+	
+	if(pipe(conWakeFds) || fcntl(conWakeFds[0], F_SETFL, O_NONBLOCK) || fcntl(conWakeFds[1], F_SETFL, O_NONBLOCK)){
+		perror("cannot create console wakeup pipe");
+		exit(-1);
+	}
+	
+	sigemptyset(&sigs);	//signals go to the emulator thread, it might be in hostIdle() waiting for them
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldSigs);
+	if(console){
+		
+		if(pthread_create(&conThread, NULL, conReaderThread, NULL)){
+			fprintf(stderr, "cannot start console thread\n");
+			exit(-1);
+		}
+		pthread_detach(conThread);
+	}
+	if(pthread_create(&blkThread, NULL, blkWorkerThread, NULL)){
+		fprintf(stderr, "cannot start disk thread\n");
+		exit(-1);
+	}
+	pthread_detach(blkThread);
+	pthread_sigmask(SIG_SETMASK, &oldSigs, NULL);
+}
+
+/*
+	fork server (-F). the guest boots once, up to the -T text, then stops and we read instance names from stdin, one
+	per line. each name forks off a child that carries on from right there. fork() gives it a copy-on-write copy of
+	guest RAM (as big a calloc() as that is a private anonymous mapping already) and of everything else, so starting
+	one costs page tables, not a boot. its disk is a fresh overlay FORKDIR/name.ovl over the image, its console the
+	fifos FORKDIR/name.in and FORKDIR/name.out. nothing writes the image after the fork, whatever the guest had
+	written to it by then is flushed first. the server itself never runs the guest again, and reads no console
+*/
+
+#define FORK_PATH_SZ	4096
+#define FORK_NAME_SZ	256
+
+static Boolean forkPrvFifo(const char* name, const char* ext, int to){
+	
+	char path[FORK_PATH_SZ];
+	int fd;
+	
+	snprintf(path, sizeof(path), "%s/%s.%s", forkDir, name, ext);
+	if(mkfifo(path, 0644) && errno != EEXIST) return false;
+	
+	fd = open(path, O_RDWR);	//does not wait for the other end, and .in never hits eof as its writers come and go
+	if(fd < 0 || dup2(fd, to) < 0) return false;
+	close(fd);
+	
+	return true;
+}
+
+static const char* forkPrvServe(int root, RootCow* cow, struct termios* term){	//only ever returns in a child, with its overlay's path
+	
+	static char path[FORK_PATH_SZ];
+	char name[FORK_NAME_SZ];
+	UInt32 len;
+	pid_t pid;
+	
+	socBlkDrain(&soc);
+	if(soc.blkF(soc.blkD, 0, NULL, 0, BLK_OP_FLUSH) <= 0){
+		
+		fprintf(stderr, "\r\n[fork] cannot flush the disk\r\n");
+		exit(-1);
+	}
+	conFlush();
+	tcsetattr(0, TCSANOW, term);	//names come in lines
+	signal(SIGCHLD, SIG_IGN);	//nobody waits for them
+	fprintf(stderr, "\r\n[fork] ready, one instance name per line\r\n");
+	
+	while(fgets(name, sizeof(name), stdin)){
+		
+		len = strcspn(name, "\r\n");
+		name[len] = 0;
+		if(!len || strchr(name, '/')) continue;
+		
+		pid = fork();
+		if(pid < 0) perror("cannot fork");
+		else if(pid) fprintf(stderr, "[fork] %s is pid %d\n", name, (int)pid);
+		if(pid) continue;
+		
+		signal(SIGCHLD, SIG_DFL);
+		if(!forkPrvFifo(name, "in", 0) || !forkPrvFifo(name, "out", 1)){
+			
+			fprintf(stderr, "[fork] %s: cannot set up console\n", name);
+			exit(-1);
+		}
+		
+		snprintf(path, sizeof(path), "%s/%s.ovl", forkDir, name);
+		unlink(path);		//one left over from before would not agree with what the guest has in RAM
+		if(!rootPrvCowOpen(cow, root, path)){
+			
+			fprintf(stderr, "[fork] %s: cannot create overlay\n", name);
+			exit(-1);
+		}
+		soc.blkF = rootCowOps;
+		soc.blkD = cow;
+		
+		//threads do not survive a fork, nor can we know what state they left our locks in
+		close(conWakeFds[0]);
+		close(conWakeFds[1]);
+		pthread_mutex_init(&blkLock, NULL);
+		pthread_cond_init(&blkCond, NULL);
+		pthread_mutex_init(&rootWbLock, NULL);
+		blkQueued = 0;
+		blkDone = 0;
+		hostPrvStart(true);
+		
+		return path;
+	}
+	
+	exit(0);
+}
 
 int main(int argc, char** argv){
 	
 	struct termios cfg, old;
-	FILE* root = NULL;
+	int root = -1;
+	Boolean paced = false, mapped = false;
+	RootMap map;
+	static RootCow cow;
+	const char* overlay = NULL;
+	const char* restore = NULL;
+	int c;
 	
-	if(argc != 2){
-		fprintf(stderr,"usage: %s path_to_disk\n", argv[0]);
+	while((c = getopt(argc, argv, "wmo:S:T:R:F:")) != -1){
+		
+		switch(c){
+			case 'w':
+				paced = true;
+				break;
+			
+			case 'm':
+				mapped = true;
+				break;
+			
+			case 'o':
+				overlay = optarg;
+				break;
+			
+			case 'S':
+				snapPath = optarg;
+				break;
+			
+			case 'T':
+				snapMarker = optarg;
+				break;
+			
+			case 'R':
+				restore = optarg;
+				break;
+			
+			case 'F':
+				forkDir = optarg;
+				break;
+			
+			default:
+				argc = 0;	//force the usage message
+				break;
+		}
+	}
+	
+	if(argc != optind + 1 || (mapped && overlay) || (forkDir && (mapped || overlay))){
+		fprintf(stderr,"usage: %s [-w] [-m | -o path_to_overlay | -F dir] [-S path_to_snapshot] [-T text] [-R path_to_snapshot] path_to_disk\n", argv[0]);
+		fprintf(stderr,"\t-w\tOS timer runs off the host's clock at 3.6864MHz instead of instrs executed\n");
+		fprintf(stderr,"\t-m\tmap the disk image into memory instead of doing file I/O on it\n");
+		fprintf(stderr,"\t-o\tleave the disk image alone, writes go to this copy-on-write overlay (made if missing)\n");
+		fprintf(stderr,"\t-S\tsave the machine here once the console prints the -T text (default \"login:\"), and on SIGUSR2\n");
+		fprintf(stderr,"\t-R\tstart from a machine saved with -S by this version. the disk is not in it, give the same one (or an overlay)\n");
+		fprintf(stderr,"\t-F\tfork server: once the -T text is seen (or SIGUSR2, or right away with -R), each name read from stdin\n");
+		fprintf(stderr,"\t\tstarts a copy of the machine with its own disk overlay dir/name.ovl and console fifos dir/name.in, .out\n");
 		return -1;	
 	}
 	
@@ -186,17 +975,60 @@ int main(int argc, char** argv){
 		if(ret) perror("cannot set term attrs");
 	}
 	
-	root = fopen64(argv[1], "r+b");
-	if(!root){
+	root = open(argv[optind], overlay ? O_RDONLY : O_RDWR);
+	if(root < 0){
 		fprintf(stderr,"Failed to open root device\n");
 		exit(-1);
 	}
 	
-	socInit(&soc, socRamModeAlloc, NULL, readchar, writechar, rootOps, root);
+	if(overlay && !rootPrvCowOpen(&cow, root, overlay)){
+		
+		fprintf(stderr,"Failed to open overlay, or it was made for another base image\n");
+		exit(-1);
+	}
+	
+	if(mapped && !rootPrvMap(&map, root)){
+		
+		fprintf(stderr,"Cannot map root device, using file I/O\n");
+		mapped = false;
+	}
+	
+	if(mapped) socInit(&soc, socRamModeAlloc, NULL, readchar, writechar, rootMapOps, &map);
+	else if(overlay) socInit(&soc, socRamModeAlloc, NULL, readchar, writechar, rootCowOps, &cow);
+	else socInit(&soc, socRamModeAlloc, NULL, readchar, writechar, rootOps, &root);
+	socSetPacedTimer(&soc, paced);
+	
+	if(restore && !snapPrvRestore(restore)){
+		
+		fprintf(stderr,"Failed to restore snapshot\n");
+		exit(-1);
+	}
+	
+	if(restore && forkDir) snapWanted = 1;	//booted already, serve right away
+	
+	hostPrvStart(!forkDir);		//the fork server's stdin is for instance names
+	
 	signal(SIGINT, &ctl_cHandler);
-	socRun(&soc);
+	signal(SIGUSR1, &statsHandler);
+	if(snapPath || forkDir) signal(SIGUSR2, &snapHandler);
+	while(1){
+		
+		socRun(&soc);
+		if(!snapWanted) break;
+		
+		snapWanted = 0;
+		if(snapPath) snapPrvSave();
+		if(forkDir && !overlay) overlay = forkPrvServe(root, &cow, &old);	//in the child from here on
+		soc.go = true;
+	}
+	conFlush();
 	
-	fclose(root);
+	pthread_mutex_lock(&rootWbLock);
+	rootPrvWbOut();
+	pthread_mutex_unlock(&rootWbLock);
+	if(mapped) munmap(map.map, map.sz);
+	if(overlay) close(cow.ovl);
+	close(root);
 	tcsetattr(0, TCSANOW, &old);
 	
 	return 0;
@@ -224,8 +1056,53 @@ UInt32 rtcCurTime(void){
 	return tv.tv_sec;	
 }
 
+UInt64 hostClockNs(void){
+	
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (UInt64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void hostIdle(UInt64 ns){
+	
+	struct timeval tv;
+	fd_set set;
+	char buf[64];
+	
+	conFlush();	//nothing more is coming for a while
+	
+	tv.tv_sec = ns / 1000000000ULL;
+	tv.tv_usec = (ns % 1000000000ULL) / 1000;
+	
+	FD_ZERO(&set);
+	FD_SET(conWakeFds[0], &set);
+	
+	if(select(conWakeFds[0] + 1, &set, NULL, NULL, &tv) > 0){	//a signal cuts this short too, which is what we want for ^C
+		
+		while(read(conWakeFds[0], buf, sizeof(buf)) > 0);
+	}
+}
+
+Boolean hostConsoleReady(void){
+	
+	if(statsWanted){	//we get called often enough, no need to do this in the signal handler
+		statsWanted = 0;
+		printStats();
+	}
+	
+	if(snapWanted) socStop(&soc);	//main() saves once socRun() is out of the way
+	
+	if(conOutLen && hostClockNs() - conOutSince > CON_OUT_MAX_AGE) conFlush();
+	rootPrvWbAge();
+	
+	return __atomic_exchange_n(&conArrived, 0, __ATOMIC_ACQUIRE) != 0;
+}
+
 void err_str(const char* str){
 	
+	conFlush();	//keep it in order with the console
 	fprintf(stderr, "%s", str);	
 }
 
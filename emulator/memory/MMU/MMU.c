@@ -1,24 +1,92 @@
 #include "MMU.h"
 
-void mmuTlbFlush(ArmMmu* mmu){
+/*
+	both tlbs are flushed by moving to a new generation, entries from older ones simply never match. only when the
+	generation counter wraps do we have to go and actually clear things
+*/
+
+static void mmuPrvDtlbFlush(ArmMmu* mmu){
+	
+	UInt32 i, j;
+	
+	if(++mmu->dtlbGen < MMU_DTLB_PAGE_SZ) return;
+	
+	for(i = 0; i < 4; i++){
+		for(j = 0; j < (1UL << MMU_DTLB_BITS); j++) mmu->dtlb[i][j].tag = MMU_DTLB_INVALID;
+	}
+	mmu->dtlbGen = 1;
+}
+
+static void mmuPrvTlbFlush(ArmMmu* mmu){
 	
 	UInt8 i, j;
 	
+	if(++mmu->tlbGen) return;
+	
 	for(i = 0; i < MMU_TLB_BUCKET_NUM; i++){
 		for(j = 0; j < MMU_TLB_BUCKET_SIZE; j++) mmu->tlb[i][j].sz = 0;
 		mmu->replPos[i] = 0;
 		mmu->readPos[i] = 0;
-	}	
+	}
 }
 
+void mmuTlbInval(ArmMmu* mmu, UInt8 which){
+	
+	if(which & (MMU_TLB_I | MMU_TLB_D)) mmuPrvTlbFlush(mmu);	//the main tlb serves both
+	if(which & MMU_TLB_D) mmuPrvDtlbFlush(mmu);
+}
 
-void mmuInit(ArmMmu* mmu, ArmMmuReadF readF, void* userData){
+void mmuTlbFlush(ArmMmu* mmu){
+	
+	mmuTlbInval(mmu, MMU_TLB_I | MMU_TLB_D);
+}
+
+void mmuTlbInvalAddr(ArmMmu* mmu, UInt32 va, UInt8 which){
+	
+	ArmPrvTlb* t;
+	ArmMmuDtlb* e;
+	UInt32 i, j;
+	
+	//a mapping lands in the bucket of whichever address missed first, so look everywhere
+	for(i = 0; i < MMU_TLB_BUCKET_NUM; i++){
+		for(j = 0; j < MMU_TLB_BUCKET_SIZE; j++){
+			
+			t = &mmu->tlb[i][j];
+			if(t->gen == mmu->tlbGen && va - t->va < t->sz) t->sz = 0;
+		}
+	}
+	
+	if(!(which & MMU_TLB_D)) return;
+	
+	//same for data tlb pages that came from a larger mapping
+	for(i = 0; i < 4; i++){
+		for(j = 0; j < (1UL << MMU_DTLB_BITS); j++){
+			
+			e = &mmu->dtlb[i][j];
+			if(!((e->tag ^ va) & e->mapMask)) e->tag = MMU_DTLB_INVALID;
+		}
+	}
+}
+
+void mmuDtlbFill(ArmMmu* mmu, UInt32 va, Boolean priviledged, Boolean write, UInt8* hostPage, UInt32 mapSz){
+	
+	ArmMmuDtlb* e = &mmu->dtlb[priviledged * 2 + write][(va / MMU_DTLB_PAGE_SZ) & ((1UL << MMU_DTLB_BITS) - 1)];
+	
+	e->tag = (va &~ (MMU_DTLB_PAGE_SZ - 1)) | mmu->dtlbGen;
+	e->mapMask = ~(mapSz - 1) &~ (MMU_DTLB_PAGE_SZ - 1);		//mapSz of 0 (mmu off) makes this match everything
+	e->host = hostPage;
+}
+
+
+void mmuInit(ArmMmu* mmu, ArmMmuReadF readF, ArmMmuHostPtrF hostPtrF, void* userData){
 
 	__mem_zero(mmu, sizeof(ArmMmu));
 	mmu->readF = readF;
+	mmu->hostPtrF = hostPtrF;
 	mmu->userData = userData;
 	mmu->transTablPA = MMU_DISABLED_TTP;
 	mmu->domainCfg = 0;
+	mmu->dtlbGen = 1;
 	mmuTlbFlush(mmu);
 }
 
@@ -36,7 +104,41 @@ static _INLINE_ UInt8 mmuPrvHashAddr(UInt32 addr){	//addresses are granular on 1
 	return addr % MMU_TLB_BUCKET_NUM;
 }
 
-Boolean mmuTranslate(ArmMmu* mmu, UInt32 adr, Boolean priviledged, Boolean write, UInt32* paP, UInt8* fsrP){
+/*
+	page table walks read descriptors straight from host memory when the tables are in RAM. only where the tables
+	are gets cached, never what is in them, so guest writes to page tables need no special care
+*/
+
+static _INLINE_ Boolean mmuPrvReadL1(ArmMmu* mmu, UInt32* descP, UInt32 adr){
+	
+	if(mmu->ttHost){
+		
+		*descP = mmu->ttHost[adr >> 20];
+		return true;
+	}
+	
+	return mmu->readF(mmu->userData, descP, mmu->transTablPA + ((adr & 0xFFF00000) >> 18));
+}
+
+static _INLINE_ Boolean mmuPrvReadL2(ArmMmu* mmu, UInt32* descP, UInt32 pa){
+	
+	ArmMmuL2Cache* c = &mmu->l2Cache[(pa >> 10) % MMU_L2_CACHE_NUM];
+	
+	if(!c->host || c->pa != (pa &~ 0x3FFUL)){
+		
+		UInt32* host = mmu->hostPtrF ? (UInt32*)mmu->hostPtrF(mmu->userData, pa &~ 0x3FFUL, 1024) : NULL;
+		
+		if(!host) return mmu->readF(mmu->userData, descP, pa);
+		
+		c->pa = pa &~ 0x3FFUL;
+		c->host = host;
+	}
+	
+	*descP = c->host[(pa & 0x3FFUL) >> 2];
+	return true;
+}
+
+Boolean mmuTranslate(ArmMmu* mmu, UInt32 adr, Boolean priviledged, Boolean write, UInt32* paP, UInt8* fsrP, UInt32* mapSzP){
 
 	UInt32 va, pa = 0, sz, t;
 	UInt8 i, j, dom, ap = 0;
@@ -47,6 +149,7 @@ Boolean mmuTranslate(ArmMmu* mmu, UInt32 adr, Boolean priviledged, Boolean write
 		
 	if(mmu->transTablPA == MMU_DISABLED_TTP){
 		va = pa = 0;
+		sz = 0;		//the whole space
 		goto calc;
 	}
 
@@ -62,7 +165,7 @@ Boolean mmuTranslate(ArmMmu* mmu, UInt32 adr, Boolean priviledged, Boolean write
 			va = mmu->tlb[bucket][i].va;
 			sz = mmu->tlb[bucket][i].sz;
 			
-			if(va <= adr && va + sz > adr){
+			if(mmu->tlb[bucket][i].gen == mmu->tlbGen && va <= adr && va + sz > adr){
 				
 				pa = mmu->tlb[bucket][i].pa;
 				ap = mmu->tlb[bucket][i].ap;
@@ -76,12 +179,14 @@ Boolean mmuTranslate(ArmMmu* mmu, UInt32 adr, Boolean priviledged, Boolean write
 	
 	//read first level table
 	
+	mmu->tlbMisses++;
+	
 	if(mmu->transTablPA & 3){
 		*fsrP = 0x01;	//alignment fault
 		return false;
 	}
 	
-	if(!mmu->readF(mmu->userData, &t, mmu->transTablPA + ((adr & 0xFFF00000) >> 18))){
+	if(!mmuPrvReadL1(mmu, &t, adr)){
 		
 		*fsrP = 0x0C;	//translation external abort first level
 		return false;
@@ -121,7 +226,7 @@ Boolean mmuTranslate(ArmMmu* mmu, UInt32 adr, Boolean priviledged, Boolean write
 	
 	//read second level table
 	
-	if(!mmu->readF(mmu->userData, &t, t)){
+	if(!mmuPrvReadL2(mmu, &t, t)){
 		*fsrP = 0x0E | (dom << 4);	//translation external abort second level
 		return false;
 	}
@@ -193,6 +298,7 @@ translated:
 		mmu->tlb[bucket][mmu->replPos[bucket]].va = va;
 		mmu->tlb[bucket][mmu->replPos[bucket]].ap = ap;
 		mmu->tlb[bucket][mmu->replPos[bucket]].domain = dom;
+		mmu->tlb[bucket][mmu->replPos[bucket]].gen = mmu->tlbGen;
 		mmu->readPos[bucket] = mmu->replPos[bucket];
 		if(++mmu->replPos[bucket] == MMU_TLB_BUCKET_SIZE) mmu->replPos[bucket] = 0;
 	}
@@ -254,6 +360,7 @@ check:
 calc:
 
 	*paP = adr - va + pa;
+	if(mapSzP) *mapSzP = sz;
 	return true;
 }
 
@@ -272,17 +379,23 @@ void mmuSetTTP(ArmMmu* mmu, UInt32 ttp){
 		mmu->replPos[i] = 0;
 		mmu->readPos[i] = 0;
 	}
+	for(i = 0; i < MMU_L2_CACHE_NUM; i++) mmu->l2Cache[i].host = NULL;
+	
 	mmu->transTablPA = ttp;
+	mmu->ttHost = NULL;
+	if(ttp != MMU_DISABLED_TTP && !(ttp & 3) && mmu->hostPtrF) mmu->ttHost = (UInt32*)mmu->hostPtrF(mmu->userData, ttp, 16384);
 }
 
 void mmuSetS(ArmMmu* mmu, Boolean on){
 
 	mmu->S = on;	
+	mmuPrvDtlbFlush(mmu);
 }
 
 void mmuSetR(ArmMmu* mmu, Boolean on){
 
 	mmu->R = on;	
+	mmuPrvDtlbFlush(mmu);
 }
 
 Boolean mmuGetS(ArmMmu* mmu){
@@ -303,6 +416,7 @@ UInt32 mmuGetDomainCfg(ArmMmu* mmu){
 void mmuSetDomainCfg(ArmMmu* mmu, UInt32 val){
 	
 	mmu->domainCfg = val;
+	mmuPrvDtlbFlush(mmu);
 }
 
 ///////////////////////////  debugging helpers  ///////////////////////////
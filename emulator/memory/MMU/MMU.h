@@ -10,8 +10,18 @@
 #define MMU_TLB_BUCKET_NUM	32
 #define MMU_DISABLED_TTP	0xFFFFFFFFUL
 
+#define MMU_DTLB_BITS		8			//log2 of data tlb entries per access type
+#define MMU_DTLB_PAGE_SZ	4096UL			//granularity of the data tlb. mappings smaller than this don't go in it
+#define MMU_DTLB_INVALID	0UL			//never matches, tags always have a nonzero generation in the low bits
+
+#define MMU_TLB_I		1			//translations used for instr fetches (for mmuTlbInval*)
+#define MMU_TLB_D		2			//translations used for data accesses
+
+
+#define MMU_L2_CACHE_NUM	32			//page tables we remember host pointers for
 
 typedef Err (*ArmMmuReadF)(void* userData, UInt32* buf, UInt32 pa);	//read a word
+typedef UInt8* (*ArmMmuHostPtrF)(void* userData, UInt32 pa, UInt32 sz);	//where [pa, pa + sz) is in host memory, NULL if it is not plain RAM
 
 #define errMmuTranslation		(errMmu + 1)
 #define	errMmuDomain			(errMmu + 2)
@@ -23,9 +33,25 @@ typedef struct {
 	UInt32 sz;
 	UInt32 ap:2;
 	UInt32 domain:4;
+	UInt32 gen;		//only valid if this matches mmu->tlbGen
 	
 }ArmPrvTlb;
 
+typedef struct {
+	
+	UInt32 tag;		//page address this entry translates ORed with mmu->dtlbGen at fill time, MMU_DTLB_INVALID if none
+	UInt32 mapMask;		//covers the whole mapping this page came from, for invalidation by address
+	UInt8* host;		//where the page is in host memory
+	
+}ArmMmuDtlb;
+
+typedef struct {
+	
+	UInt32 pa;		//1K block of second level descriptors
+	UInt32* host;		//NULL if this slot is unused
+	
+}ArmMmuL2Cache;
+
 typedef struct ArmMmu{
 
 	UInt32 transTablPA;
@@ -34,16 +60,25 @@ typedef struct ArmMmu{
 	UInt8 readPos[MMU_TLB_BUCKET_NUM];
 	UInt8 replPos[MMU_TLB_BUCKET_NUM];
 	ArmPrvTlb tlb[MMU_TLB_BUCKET_NUM][MMU_TLB_BUCKET_SIZE];
+	ArmMmuDtlb dtlb[4][1UL << MMU_DTLB_BITS];	//indexed by access type (priviledged * 2 + write) and then page
+	UInt32 tlbGen;					//flushing is just bumping these
+	UInt32 dtlbGen;					//1 ... MMU_DTLB_PAGE_SZ - 1
+	UInt32 tlbMisses;				//page table walks
+	UInt32 dtlbMisses;
 	UInt32 domainCfg;
 	ArmMmuReadF readF;
+	ArmMmuHostPtrF hostPtrF;
 	void* userData;
+	
+	UInt32* ttHost;					//first level table in host memory, NULL if it is not in RAM
+	ArmMmuL2Cache l2Cache[MMU_L2_CACHE_NUM];
 
 }ArmMmu;
 
 
-void mmuInit(ArmMmu* mmu, ArmMmuReadF readF, void* userData);
+void mmuInit(ArmMmu* mmu, ArmMmuReadF readF, ArmMmuHostPtrF hostPtrF, void* userData);	//hostPtrF may be NULL
 void muDeinit(ArmMmu* mmu);
-Boolean mmuTranslate(ArmMmu* mmu, UInt32 va, Boolean priviledged, Boolean write, UInt32* paP, UInt8* fsrP);
+Boolean mmuTranslate(ArmMmu* mmu, UInt32 va, Boolean priviledged, Boolean write, UInt32* paP, UInt8* fsrP, UInt32* mapSzP);	//*mapSzP gets the size of the mapping used, 0 if the mmu is off. may be NULL
 
 UInt32 mmuGetTTP(ArmMmu* mmu);
 void mmuSetTTP(ArmMmu* mmu, UInt32 ttp);
@@ -57,6 +92,29 @@ UInt32 mmuGetDomainCfg(ArmMmu* mmu);
 void mmuSetDomainCfg(ArmMmu* mmu, UInt32 val);
 
 void mmuTlbFlush(ArmMmu* mmu);
+void mmuTlbInval(ArmMmu* mmu, UInt8 which);			//which is MMU_TLB_I and/or MMU_TLB_D
+void mmuTlbInvalAddr(ArmMmu* mmu, UInt32 va, UInt8 which);	//just the entries translating va
+
+/*
+	the data tlb remembers host pointers for pages that translated to plain RAM, for each kind of access separately,
+	so a hit already implies the permission check passed. it is flushed along with the real tlb for data side tlb ops
+	and whenever anything that goes into permission checks changes
+*/
+
+void mmuDtlbFill(ArmMmu* mmu, UInt32 va, Boolean priviledged, Boolean write, UInt8* hostPage, UInt32 mapSz);	//mapSz as mmuTranslate() gave it
+
+static _INLINE_ UInt8* mmuDtlbLookup(ArmMmu* mmu, UInt32 va, Boolean priviledged, Boolean write){	//NULL on miss
+	
+	ArmMmuDtlb* e = &mmu->dtlb[priviledged * 2 + write][(va / MMU_DTLB_PAGE_SZ) & ((1UL << MMU_DTLB_BITS) - 1)];
+	
+	if(e->tag != ((va &~ (MMU_DTLB_PAGE_SZ - 1)) | mmu->dtlbGen)){
+		
+		mmu->dtlbMisses++;
+		return NULL;
+	}
+	
+	return e->host + (va & (MMU_DTLB_PAGE_SZ - 1));
+}
 
 
 
@@ -104,7 +104,7 @@ Boolean ramInit(ArmRam* ram, ArmMem* mem, UInt32 adr, UInt32 sz, UInt32* buf){
 	ram->sz = sz;
 	ram->buf = buf;
 	
-	return memRegionAdd(mem, adr, sz, &ramAccessF, ram);	
+	return memRegionAddRam(mem, adr, sz, &ramAccessF, ram, buf);	
 }
 
 Boolean ramDeinit(ArmRam* ram, ArmMem* mem){
@@ -1,26 +1,131 @@
 #include "mem.h"
+#include "../helper/external.h"
 
 
+/*
+	physical addresses are resolved with a two level table: a byte per 1M chunk naming the region there, and for
+	chunks that more than one region touches, a byte per 4K page. only pages shared by several regions (which only
+	happens with tiny ones) need to look at the region list, so the cost of a lookup does not depend on how many
+	devices there are
+*/
+
+static Boolean memPrvRegionTouches(ArmMemRegion* r, UInt32 pa, UInt32 sz){
+	
+	if(!r->sz) return false;
+	
+	return (r->pa - pa < sz) || (pa - r->pa < r->sz);
+}
+
+static UInt8 memPrvResolve(ArmMem* mem, UInt32 pa, UInt32 sz){	//what a lookup entry covering [pa, pa + sz) should say
+	
+	UInt8 i, found = MEM_NO_REGION;
+	
+	for(i = 0; i < MAX_MEM_REGIONS; i++){
+		
+		if(!memPrvRegionTouches(&mem->regions[i], pa, sz)) continue;
+		if(found != MEM_NO_REGION) return MEM_MANY_REGIONS;
+		found = i + 1;
+	}
+	
+	return found;
+}
+
+static void memPrvRemap(ArmMem* mem, UInt32 pa, UInt32 sz){	//redo lookup entries for everything in [pa, pa + sz)
+	
+	UInt32 chunk, last, page, t;
+	UInt8 v;
+	
+	chunk = pa >> MEM_CHUNK_SHIFT;
+	last = (pa + sz - 1) >> MEM_CHUNK_SHIFT;
+	
+	do{
+		t = chunk << MEM_CHUNK_SHIFT;
+		v = memPrvResolve(mem, t, 1UL << MEM_CHUNK_SHIFT);
+		
+		if(v != MEM_MANY_REGIONS){
+			
+			if(mem->pages[chunk]){
+				
+				emu_free(mem->pages[chunk]);
+				mem->pages[chunk] = NULL;
+			}
+		}
+		else{
+			
+			if(!mem->pages[chunk]) mem->pages[chunk] = emu_alloc(MEM_PAGES_PER_CHUNK);
+			if(!mem->pages[chunk]){
+				
+				err_str("Cannot allocate memory page map, halting\r\n");
+				while(1);
+			}
+			for(page = 0; page < MEM_PAGES_PER_CHUNK; page++){
+				
+				mem->pages[chunk][page] = memPrvResolve(mem, t + (page << MEM_PAGE_SHIFT), 1UL << MEM_PAGE_SHIFT);
+			}
+		}
+		mem->chunks[chunk] = v;
+	}while(chunk++ != last);
+}
+
+static _INLINE_ ArmMemRegion* memPrvLookup(ArmMem* mem, UInt32 addr){	//NULL if nothing claims addr
+	
+	ArmMemRegion* r;
+	UInt8 v, i;
+	
+	v = mem->chunks[addr >> MEM_CHUNK_SHIFT];
+	if(v == MEM_MANY_REGIONS) v = mem->pages[addr >> MEM_CHUNK_SHIFT][(addr >> MEM_PAGE_SHIFT) & (MEM_PAGES_PER_CHUNK - 1)];
+	
+	if(v == MEM_NO_REGION) return NULL;
+	if(v == MEM_MANY_REGIONS){
+		
+		for(i = 0; i < MAX_MEM_REGIONS; i++){
+			
+			r = &mem->regions[i];
+			if(r->sz && addr - r->pa < r->sz) return r;
+		}
+		return NULL;
+	}
+	
+	r = &mem->regions[v - 1];
+	
+	return (addr - r->pa < r->sz) ? r : NULL;	//the region might not span the whole chunk or page
+}
 
 void memInit(ArmMem* mem){
 	
-	UInt8 i;
+	UInt32 i;
 	
 	for(i = 0; i < MAX_MEM_REGIONS; i++){
 		mem->regions[i].sz = 0;
 	}
+	for(i = 0; i < MEM_NUM_CHUNKS; i++){
+		mem->chunks[i] = MEM_NO_REGION;
+		mem->pages[i] = NULL;
+	}
 }
 
 
-void memDeinit(_UNUSED_ ArmMem* mem){
+void memDeinit(ArmMem* mem){
 	
-	//nothing here
+	UInt32 i;
+	
+	for(i = 0; i < MEM_NUM_CHUNKS; i++){
+		if(mem->pages[i]) emu_free(mem->pages[i]);
+		mem->pages[i] = NULL;
+	}
 }
 
 Boolean memRegionAdd(ArmMem* mem, UInt32 pa, UInt32 sz, ArmMemAccessF aF, void* uD){
 
+	return memRegionAddRam(mem, pa, sz, aF, uD, NULL);
+}
+
+Boolean memRegionAddRam(ArmMem* mem, UInt32 pa, UInt32 sz, ArmMemAccessF aF, void* uD, void* host){
+
 	UInt8 i;
 	
+	if(!sz) return false;
+	
 	//check for intersection with another region
 	
 	for(i = 0; i < MAX_MEM_REGIONS; i++){
@@ -42,6 +147,8 @@ Boolean memRegionAdd(ArmMem* mem, UInt32 pa, UInt32 sz, ArmMemAccessF aF, void*
 			mem->regions[i].sz = sz;
 			mem->regions[i].aF = aF;
 			mem->regions[i].uD = uD;
+			mem->regions[i].host = host;
+			memPrvRemap(mem, pa, sz);
 		
 			return true;
 		}
@@ -61,6 +168,7 @@ Boolean memRegionDel(ArmMem* mem, UInt32 pa, UInt32 sz){
 		if(mem->regions[i].pa == pa && mem->regions[i].sz ==sz){
 		
 			mem->regions[i].sz = 0;
+			memPrvRemap(mem, pa, sz);
 			return true;
 		}
 	}
@@ -70,13 +178,11 @@ Boolean memRegionDel(ArmMem* mem, UInt32 pa, UInt32 sz){
 
 Boolean memAccess(ArmMem* mem, UInt32 addr, UInt8 size, Boolean write, void* buf){
 	
-	UInt8 i;
+	ArmMemRegion* r = memPrvLookup(mem, addr);
 	
-	for(i = 0; i < MAX_MEM_REGIONS; i++){
-		if(mem->regions[i].pa <= addr && mem->regions[i].pa + mem->regions[i].sz > addr){
+	if(r){
 		
-			return mem->regions[i].aF(mem->regions[i].uD, addr, size, write & 0x7F, buf);
-		}
+		return r->aF(r->uD, addr, size, write & 0x7F, buf);
 	}
 	
 	if(!(write & 0x80)){	//high bit in write tells us to not print this error (used by gdb stub)
@@ -94,3 +200,11 @@ Boolean memAccess(ArmMem* mem, UInt32 addr, UInt8 size, Boolean write, void* buf
 	return false;
 }
 
+UInt8* memGetHostPtr(ArmMem* mem, UInt32 addr, UInt32 size){
+	
+	ArmMemRegion* r = memPrvLookup(mem, addr);
+	
+	if(!r || !r->host || size > r->sz || addr - r->pa > r->sz - size) return NULL;	//so that a huge size cannot wrap around
+	
+	return r->host + (addr - r->pa);
+}
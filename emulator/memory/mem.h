@@ -3,7 +3,15 @@
 
 #include "../helper/types.h"
 
-#define MAX_MEM_REGIONS		16
+#define MAX_MEM_REGIONS		64		//must stay below MEM_MANY_REGIONS
+
+#define MEM_CHUNK_SHIFT		20		//first level of the lookup: 1M chunks
+#define MEM_PAGE_SHIFT		12		//second level: 4K pages, only for chunks more than one region touches
+#define MEM_NUM_CHUNKS		(1UL << (32 - MEM_CHUNK_SHIFT))
+#define MEM_PAGES_PER_CHUNK	(1UL << (MEM_CHUNK_SHIFT - MEM_PAGE_SHIFT))
+
+#define MEM_NO_REGION		0x00		//lookup entries hold region index + 1, or one of these
+#define MEM_MANY_REGIONS	0xFF		//more than one region in here, look closer
 
 #define errPhysMemNoSuchRegion	(errPhysMem + 1)		//this physical address is not claimed by any region
 #define errPhysMemInvalidAdr	(errPhysMem + 2)		//address is IN a region but access to it is not allowed (it doesn't exist really)
@@ -17,12 +25,15 @@ typedef struct{
 	UInt32 sz;
 	ArmMemAccessF aF;
 	void* uD;
+	UInt8* host;		//plain host memory behind the whole region, NULL if it is a device
 
 }ArmMemRegion;
 
 typedef struct{
 
 	ArmMemRegion regions[MAX_MEM_REGIONS];
+	UInt8 chunks[MEM_NUM_CHUNKS];
+	UInt8* pages[MEM_NUM_CHUNKS];		//MEM_PAGES_PER_CHUNK entries for chunks marked MEM_MANY_REGIONS
 
 }ArmMem;
 
@@ -31,8 +42,10 @@ void memInit(ArmMem* mem);
 void memDeinit(ArmMem* mem);
 
 Boolean memRegionAdd(ArmMem* mem, UInt32 pa, UInt32 sz, ArmMemAccessF af, void* uD);
+Boolean memRegionAddRam(ArmMem* mem, UInt32 pa, UInt32 sz, ArmMemAccessF af, void* uD, void* host);	//for regions that are just host memory, lets others bypass af
 Boolean memRegionDel(ArmMem* mem, UInt32 pa, UInt32 sz);
 
 Boolean memAccess(ArmMem* mem, UInt32 addr, UInt8 size, Boolean write, void* buf);
+UInt8* memGetHostPtr(ArmMem* mem, UInt32 addr, UInt32 size);		//NULL unless [addr, addr + size) is all in host memory
 
 #endif
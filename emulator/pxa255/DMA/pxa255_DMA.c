@@ -114,3 +114,10 @@ Boolean pxa255dmaInit(Pxa255dma* dma, ArmMem* physMem, Pxa255ic* ic){
 	
 	return memRegionAdd(physMem, PXA255_DMA_BASE, PXA255_DMA_SIZE, pxa255dmaPrvMemAccessF, dma);
 }
+
+void pxa255dmaSnap(Pxa255dma* dma, Snap* s){
+	
+	snapVal(s, dma->DINT);
+	snapVal(s, dma->channels);
+	snapVal(s, dma->CMR);
+}
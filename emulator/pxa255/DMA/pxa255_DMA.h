@@ -37,6 +37,7 @@ typedef struct{
 
 
 Boolean pxa255dmaInit(Pxa255dma* gpio, ArmMem* physMem, Pxa255ic* ic);
+void pxa255dmaSnap(Pxa255dma* dma, Snap* s);
 
 #endif
 
@@ -75,4 +75,9 @@ Boolean pxa255dspInit(Pxa255dsp* dsp, ArmCpu* cpu){
 	cpuCoprocessorRegister(cpu, 0, &cp);
 
 	return true;
+}
+
+void pxa255dspSnap(Pxa255dsp* dsp, Snap* s){
+	
+	snapVal(s, dsp->acc0);
 }
\ No newline at end of file
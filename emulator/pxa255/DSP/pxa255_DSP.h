@@ -15,6 +15,7 @@ typedef struct{
 
 
 Boolean pxa255dspInit(Pxa255dsp* dsp, ArmCpu* cpu);
+void pxa255dspSnap(Pxa255dsp* dsp, Snap* s);
 
 
 #endif
\ No newline at end of file
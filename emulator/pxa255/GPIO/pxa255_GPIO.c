@@ -184,6 +184,18 @@ Boolean pxa255gpioInit(Pxa255gpio* gpio, ArmMem* physMem, Pxa255ic* ic){
 	return memRegionAdd(physMem, PXA255_GPIO_BASE, PXA255_GPIO_SIZE, pxa255gpioPrvMemAccessF, gpio);
 }
 
+void pxa255gpioSnap(Pxa255gpio* gpio, Snap* s){
+	
+	snapVal(s, gpio->latches);
+	snapVal(s, gpio->inputs);
+	snapVal(s, gpio->levels);
+	snapVal(s, gpio->dirs);
+	snapVal(s, gpio->riseDet);
+	snapVal(s, gpio->fallDet);
+	snapVal(s, gpio->detStatus);
+	snapVal(s, gpio->AFRs);
+}
+
 void pxa255gpioSetState(Pxa255gpio* gpio, UInt8 gpioNum, Boolean on){
 	
 	UInt32 set = gpioNum >> 5;
@@ -38,6 +38,7 @@ typedef struct{
 #define PXA255_GPIO_NOT_PRESENT		6
 
 Boolean pxa255gpioInit(Pxa255gpio* gpio, ArmMem* physMem, Pxa255ic* ic);
+void pxa255gpioSnap(Pxa255gpio* gpio, Snap* s);
 
 //for external use :)
 UInt8 pxa255gpioGetState(Pxa255gpio* gpio, UInt8 gpioNum);
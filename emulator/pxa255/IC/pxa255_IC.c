@@ -80,6 +80,16 @@ Boolean pxa255icInit(Pxa255ic* ic, ArmCpu* cpu, ArmMem* physMem){
 	return memRegionAdd(physMem, PXA255_IC_BASE, PXA255_IC_SIZE, pxa255icPrvMemAccessF, ic);
 }
 
+void pxa255icSnap(Pxa255ic* ic, Snap* s){
+	
+	snapVal(s, ic->ICMR);
+	snapVal(s, ic->ICLR);
+	snapVal(s, ic->ICCR);
+	snapVal(s, ic->ICPR);
+	snapVal(s, ic->wasIrq);
+	snapVal(s, ic->wasFiq);
+}
+
 
 void pxa255icInt(Pxa255ic* ic, UInt8 intNum, Boolean raise){		//interrupt caused by emulated hardware
 	
@@ -32,6 +32,7 @@
 #define PXA255_I_I2C		18
 #define PXA255_I_LCD		17
 #define PXA255_I_NET_SSP	16
+#define PXA255_I_PVD		15	//reserved on real hardware, we use it for pvDisk completions
 #define PXA255_I_AC97		14
 #define PXA255_I_I2S		13
 #define PXA255_I_PMU		12
@@ -56,6 +57,7 @@ typedef struct{
 }Pxa255ic;
 
 Boolean pxa255icInit(Pxa255ic* ic, ArmCpu* cpu, ArmMem* physMem);
+void pxa255icSnap(Pxa255ic* ic, Snap* s);		//the cpu snaps its own copy of what we last told it
 
 void pxa255icInt(Pxa255ic* ic, UInt8 intNum, Boolean raise);		//interrupt caused by emulated hardware/ interrupt handled by guest
 
@@ -17,9 +17,12 @@ static Boolean pxa255pwrClkPrvCoprocRegXferFunc(struct ArmCpu* cpu, void* userDa
 					if(val & 2)
 						err_str("Set speed mode");
 				}
+				else val = pc->turbo ? 1 : 0;
+				goto success;
 			
 			case 7:
 				if(read) val = pc->turbo ? 1 : 0;
+				else if((val & 3) == 1) cpuSleep(cpu);	//IDLE mode: nothing to do till an interrupt comes
 				goto success;
 		}
 	}
@@ -138,4 +141,13 @@ Boolean pxa255pwrClkInit(Pxa255pwrClk* pc, ArmCpu* cpu, ArmMem* physMem){
 	return ok;
 }
 
+void pxa255pwrClkSnap(Pxa255pwrClk* pc, Snap* s){
+	
+	snapVal(s, pc->CCCR);
+	snapVal(s, pc->CKEN);
+	snapVal(s, pc->OSCR);
+	snapVal(s, pc->pwrRegs);
+	snapVal(s, pc->turbo);
+}
+
 
@@ -24,6 +24,7 @@ typedef struct{
 
 
 Boolean pxa255pwrClkInit(Pxa255pwrClk* pc, ArmCpu* cpu, ArmMem* physMem);
+void pxa255pwrClkSnap(Pxa255pwrClk* pc, Snap* s);
 
 
 
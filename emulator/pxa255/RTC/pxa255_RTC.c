@@ -95,6 +95,15 @@ Boolean pxa255rtcInit(Pxa255rtc* rtc, ArmMem* physMem, Pxa255ic* ic){
 	return memRegionAdd(physMem, PXA255_RTC_BASE, PXA255_RTC_SIZE, pxa255rtcPrvMemAccessF, rtc);
 }
 
+void pxa255rtcSnap(Pxa255rtc* rtc, Snap* s){
+	
+	snapVal(s, rtc->RCNR_offset);
+	snapVal(s, rtc->RTAR);
+	snapVal(s, rtc->RTSR);
+	snapVal(s, rtc->RTTR);
+	snapVal(s, rtc->lastSeenTime);
+}
+
 void pxa255rtcUpdate(Pxa255rtc* rtc){
 	pxa255rtcPrvUpdate(rtc);
 }
@@ -31,6 +31,7 @@ typedef struct{
 
 Boolean pxa255rtcInit(Pxa255rtc* rtc, ArmMem* physMem, Pxa255ic* ic);
 void pxa255rtcUpdate(Pxa255rtc* rtc);
+void pxa255rtcSnap(Pxa255rtc* rtc, Snap* s);	//RCNR is kept against the host's clock, so it keeps counting across a restore
 
 
 #endif
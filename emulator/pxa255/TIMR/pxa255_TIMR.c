@@ -1,5 +1,6 @@
 #include "pxa255_TIMR.h"
 #include "../../memory/mem.h"
+#include "../../helper/external.h"
 
 
 static void pxa255timrPrvRaiseLowerInts(Pxa255timr* timr){
@@ -10,27 +11,93 @@ static void pxa255timrPrvRaiseLowerInts(Pxa255timr* timr){
 	pxa255icInt(timr->ic, PXA255_I_TIMR3, (timr->OSSR & 8) != 0);
 }
 
-static void pxa255timrPrvCheckMatch(Pxa255timr* timr, UInt8 idx){
+static UInt64 pxa255timrPrvTicks(Pxa255timr* timr){	//ticks so far. devices get ticked before the instr that hits their period, hence the "+ 1"
 	
-	UInt8 v = 1UL << idx;
+	UInt64 ns, tick;
 	
-	if((timr->OSCR == timr->OSMR[idx]) && (timr->OIER & v)){
-		timr->OSSR |= v;
+	if(!timr->paced) return (schedTime(timr->sched) + 1) / timr->period;
+	
+	ns = hostClockNs();
+	tick = timr->hostTickBase + (ns - timr->hostNsBase) * 288 / 78125;	//3.6864MHz is 288 ticks per 78125ns, that multiply will not overflow for years
+	if(tick - timr->tickChecked > PXA255_TIMR_MAX_LAG){			//too far behind, let guest time slip
+		
+		tick = timr->tickChecked + PXA255_TIMR_MAX_LAG;
+		timr->hostNsBase = ns;
+		timr->hostTickBase = tick;
+	}
+	
+	return tick;
+}
+
+static UInt64 pxa255timrPrvTickTime(Pxa255timr* timr, UInt64 tick){	//when a given tick happens
+	
+	return tick * timr->period - 1;
+}
+
+static UInt32 pxa255timrPrvOscr(Pxa255timr* timr, UInt64 tick){
+	
+	return timr->oscrBase + (UInt32)(tick - timr->tickBase);
+}
+
+static UInt32 pxa255timrPrvTicksToMatch(Pxa255timr* timr, UInt8 idx){	//ticks after the first one past tickChecked till OSCR hits OSMR[idx]
+	
+	return timr->OSMR[idx] - pxa255timrPrvOscr(timr, timr->tickChecked) - 1;
+}
+
+static void pxa255timrPrvCatchUp(Pxa255timr* timr, UInt64 tick){	//flag all matches of enabled channels up to and including this tick
+	
+	UInt8 i, v;
+	
+	for(i = 0; i < 4; i++){
+		
+		v = 1UL << i;
+		if((timr->OIER & v) && tick - timr->tickChecked > pxa255timrPrvTicksToMatch(timr, i)) timr->OSSR |= v;
+	}
+	timr->tickChecked = tick;
+}
+
+static UInt64 pxa255timrPrvNextMatch(Pxa255timr* timr){	//tick of the earliest match that would change anything, SCHED_NEVER if none
+	
+	UInt64 next = SCHED_NEVER, t;
+	UInt8 i, v;
+	
+	for(i = 0; i < 4; i++){
+		
+		v = 1UL << i;
+		if(!(timr->OIER & v) || (timr->OSSR & v)) continue;	//a flagged channel can only be unflagged by a write, which reschedules
+		
+		t = timr->tickChecked + 1 + pxa255timrPrvTicksToMatch(timr, i);
+		if(t < next) next = t;
 	}
+	
+	return next;
+}
+
+static void pxa255timrPrvSchedule(Pxa255timr* timr){	//post the earliest match that would change anything
+	
+	UInt64 next = pxa255timrPrvNextMatch(timr);
+	
+	if(next == SCHED_NEVER) schedCancel(timr->sched, &timr->matchEvt);
+	else if(!timr->paced) schedAt(timr->sched, &timr->matchEvt, pxa255timrPrvTickTime(timr, next));
+	else if(!schedIsPosted(&timr->matchEvt)) schedAt(timr->sched, &timr->matchEvt, schedTime(timr->sched) + PXA255_TIMR_PACED_POLL);
 }
 
-static void pxa255timrPrvUpdate(Pxa255timr* timr){
+static void pxa255timrPrvMatchEvt(void* userData){
 	
-	pxa255timrPrvCheckMatch(timr, 0);
-	pxa255timrPrvCheckMatch(timr, 1);
-	pxa255timrPrvCheckMatch(timr, 2);
-	pxa255timrPrvCheckMatch(timr, 3);
+	Pxa255timr* timr = userData;
+	UInt32 old = timr->OSSR;
+	
+	pxa255timrPrvCatchUp(timr, pxa255timrPrvTicks(timr));
+	if(timr->OSSR != old) pxa255timrPrvRaiseLowerInts(timr);
+	pxa255timrPrvSchedule(timr);
 }
 
 static Boolean pxa255timrPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Boolean write, void* buf){
 
 	Pxa255timr* timr = userData;
-	UInt32 val = 0;
+	UInt32 val = 0, old;
+	UInt64 tick;
+	UInt8 i;
 	
 	if(size != 4) {
 		err_str(__FILE__ ": Unexpected ");
@@ -45,6 +112,11 @@ static Boolean pxa255timrPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 	
 	pa = (pa - PXA255_TIMR_BASE) >> 2;
 	
+	tick = pxa255timrPrvTicks(timr);
+	old = timr->OSSR;
+	pxa255timrPrvCatchUp(timr, tick);	//only finds anything if the cpu overshot our event
+	if(timr->OSSR != old) pxa255timrPrvRaiseLowerInts(timr);
+	
 	if(write){
 		val = *(UInt32*)buf;
 		
@@ -54,15 +126,19 @@ static Boolean pxa255timrPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 			case 2:
 			case 3:
 				timr->OSMR[pa] = val;
+				pxa255timrPrvSchedule(timr);
 				break;
 			
 			case 4:
-				timr->OSCR = val;
+				timr->oscrBase = val;
+				timr->tickBase = tick;
+				pxa255timrPrvSchedule(timr);
 				break;
 			
 			case 5:
 				timr->OSSR = timr->OSSR &~ val;
 				pxa255timrPrvRaiseLowerInts(timr);
+				pxa255timrPrvSchedule(timr);
 				break;
 			
 			case 6:
@@ -71,8 +147,12 @@ static Boolean pxa255timrPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 			
 			case 7:
 				timr->OIER = val;
-				pxa255timrPrvUpdate(timr);
+				for(i = 0; i < 4; i++){		//enabling a channel that already matches flags it right away
+					
+					if((timr->OIER & (1UL << i)) && pxa255timrPrvOscr(timr, tick) == timr->OSMR[i]) timr->OSSR |= 1UL << i;
+				}
 				pxa255timrPrvRaiseLowerInts(timr);
+				pxa255timrPrvSchedule(timr);
 				break;
 		}
 	}
@@ -86,7 +166,7 @@ static Boolean pxa255timrPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 				break;
 			
 			case 4:
-				val = timr->OSCR;
+				val = pxa255timrPrvOscr(timr, tick);
 				break;
 			
 			case 5:
@@ -108,16 +188,63 @@ static Boolean pxa255timrPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 }
 
 
-Boolean pxa255timrInit(Pxa255timr* timr, ArmMem* physMem, Pxa255ic* ic){
+Boolean pxa255timrInit(Pxa255timr* timr, ArmMem* physMem, Pxa255ic* ic, Sched* sched, UInt32 period){
 	
 	__mem_zero(timr, sizeof(Pxa255timr));
 	timr->ic = ic;
+	timr->sched = sched;
+	timr->period = period;
+	timr->tickBase = timr->tickChecked = pxa255timrPrvTicks(timr);
+	schedEventInit(&timr->matchEvt, pxa255timrPrvMatchEvt, timr);
 	return memRegionAdd(physMem, PXA255_TIMR_BASE, PXA255_TIMR_SIZE, pxa255timrPrvMemAccessF, timr);
 }
 
-void pxa255timrTick(Pxa255timr* timr){
+UInt64 pxa255timrPacedNextNs(Pxa255timr* timr){
+	
+	UInt64 next = pxa255timrPrvNextMatch(timr);
+	
+	if(next == SCHED_NEVER) return SCHED_NEVER;
+	
+	return timr->hostNsBase + ((next - timr->hostTickBase) * 78125 + 287) / 288;	//round up, waking early would just mean sleeping again
+}
+
+void pxa255timrSetPaced(Pxa255timr* timr, Boolean paced){
+	
+	UInt64 tick = pxa255timrPrvTicks(timr);
+	
+	pxa255timrPrvCatchUp(timr, tick);
+	timr->paced = paced;
+	timr->hostNsBase = hostClockNs();
+	timr->hostTickBase = tick;
+	schedCancel(timr->sched, &timr->matchEvt);	//its deadline is in the old mode's terms
+	pxa255timrPrvSchedule(timr);
+}
+
+void pxa255timrSnap(Pxa255timr* timr, Snap* s){
+	
+	UInt64 cur = pxa255timrPrvTicks(timr), now;
+	
+	snapVal(s, timr->OSMR);
+	snapVal(s, timr->OIER);
+	snapVal(s, timr->OWER);
+	snapVal(s, timr->OSSR);
+	snapVal(s, timr->oscrBase);
+	snapVal(s, timr->tickBase);
+	snapVal(s, timr->tickChecked);
+	snapVal(s, cur);
+	
+	if(!s->load) return;
+	
+	if(timr->paced){		//carry on from the saved tick, the host clock has moved on meanwhile
+		
+		timr->hostNsBase = hostClockNs();
+		timr->hostTickBase = cur;
+		now = cur;
+	}
+	else now = pxa255timrPrvTicks(timr);
 	
-	timr->OSCR++;
-	pxa255timrPrvUpdate(timr);
-	pxa255timrPrvRaiseLowerInts(timr);
+	timr->tickBase += now - cur;		//our tick numbers may be in the other mode's terms, OSCR picks up where it was
+	timr->tickChecked += now - cur;
+	schedCancel(timr->sched, &timr->matchEvt);
+	pxa255timrPrvSchedule(timr);
 }
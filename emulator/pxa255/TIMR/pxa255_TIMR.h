@@ -4,33 +4,56 @@
 #include "../../memory/mem.h"
 #include "../../CPU/CPU.h"
 #include "../IC/pxa255_IC.h"
+#include "../../sched/sched.h"
 
 
 /*
 	PXA255 OS timers controller
 	
 	PURRPOSE: timers are useful for stuff :)
+	
+	OSCR is not counted up, it is worked out from the scheduler's time whenever someone looks. the next match of
+	any enabled channel is posted as a scheduler event, so we only run (and only bother the IC) when one fires
+	
+	when paced, OSCR instead follows the host's monotonic clock at the real 3.6864MHz. we cannot know ahead of time
+	when in instrs a match will come, so while one is pending we check the clock every PXA255_TIMR_PACED_POLL instrs.
+	if we fall far behind (host busy, emulator stopped) guest time slips rather than jump by more than
+	PXA255_TIMR_MAX_LAG ticks at once
 
 */
 
 #define PXA255_TIMR_BASE	0x40A00000UL
 #define PXA255_TIMR_SIZE	0x00010000UL
 
+#define PXA255_TIMR_PACED_POLL	2048UL		//instrs
+#define PXA255_TIMR_MAX_LAG	368640UL	//ticks, 100ms
+
 
 typedef struct{
 
 	Pxa255ic* ic;
+	Sched* sched;
+	SchedEvent matchEvt;
+	UInt32 period;		//instrs per OSCR tick, when not paced
+	Boolean paced;
+	UInt64 hostNsBase;	//when paced, tick number hostTickBase happened at host time hostNsBase
+	UInt64 hostTickBase;
 	
 	UInt32 OSMR[4];	//Match Register 0-3
 	UInt32 OIER;	//Interrupt Enable
 	UInt32 OWER;	//Watchdog enable
-	UInt32 OSCR;	//Counter Register
 	UInt32 OSSR;	//Status Register
 	
+	UInt32 oscrBase;	//Counter Register as of tick number tickBase
+	UInt64 tickBase;
+	UInt64 tickChecked;	//matches have been looked for up to and including this tick
+	
 }Pxa255timr;
 
-Boolean pxa255timrInit(Pxa255timr* timr, ArmMem* physMem, Pxa255ic* ic);
-void pxa255timrTick(Pxa255timr* timr);
+Boolean pxa255timrInit(Pxa255timr* timr, ArmMem* physMem, Pxa255ic* ic, Sched* sched, UInt32 period);
+void pxa255timrSetPaced(Pxa255timr* timr, Boolean paced);	//call before the cpu first runs
+UInt64 pxa255timrPacedNextNs(Pxa255timr* timr);			//host time of the next match that would change anything, SCHED_NEVER if none
+void pxa255timrSnap(Pxa255timr* timr, Snap* s);			//restore after the sched's time and after SetPaced
 
 
 #endif
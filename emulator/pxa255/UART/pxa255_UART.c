@@ -76,6 +76,24 @@
 static void pxa255uartPrvRecalc(Pxa255uart* uart);
 
 
+static Boolean pxa255uartPrvBusy(Pxa255uart* uart){	//does pxa255uartProcess() have anything to do?
+	
+	return !(uart->LSR & UART_LSR_TEMT) || uart->cyclesSinceRecv <= 4;
+}
+
+static void pxa255uartPrvKick(Pxa255uart* uart){
+	
+	if(uart->sched && !schedIsPosted(&uart->evt)) schedAt(uart->sched, &uart->evt, schedTime(uart->sched) + uart->period);
+}
+
+static void pxa255uartPrvEvt(void* userData){
+	
+	Pxa255uart* uart = userData;
+	
+	pxa255uartProcess(uart);
+	if(pxa255uartPrvBusy(uart)) schedAt(uart->sched, &uart->evt, uart->evt.when + uart->period);
+}
+
 static void pxa255uartPrvIrq(Pxa255uart* uart, Boolean raise){
 	
 	pxa255icInt(uart->ic, uart->irq, !(uart->MCR & UART_MCR_LOOP) && (uart->MCR & UART_MCR_OUT2) && raise/* only raise if ints are enabled */);
@@ -192,7 +210,11 @@ UInt16 pxa255uartPrvFifoPeek(UartFifo* fifo){
 
 static void sendVal(Pxa255uart* uart, UInt16 v){
 	
-	if(uart->LSR & UART_LSR_TEMT){	//if transmit, put in shift register immediately if it's idle
+	if(uart->fastTx){			//out it goes, the transmitter stays empty
+		
+		pxa255uartPrvPutchar(uart, v);
+	}
+	else if(uart->LSR & UART_LSR_TEMT){	//if transmit, put in shift register immediately if it's idle
 			
 		uart->transmitShift = v;
 		uart->LSR &=~ UART_LSR_TEMT;	
@@ -355,6 +377,7 @@ static Boolean pxa255uartPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 					
 					val = uart->receiveHolding;
 					uart->LSR &=~ UART_LSR_DR;
+					recalcValues = true;		//nobody else will lower the irq
 				}
 				break;
 			
@@ -396,6 +419,7 @@ static Boolean pxa255uartPrvMemAccessF(void* userData, UInt32 pa, UInt8 size, Bo
 	}
 	
 	if(recalcValues) pxa255uartPrvRecalc(uart);
+	if(pxa255uartPrvBusy(uart)) pxa255uartPrvKick(uart);
 	
 	return true;
 }
@@ -410,6 +434,24 @@ void pxa255uartSetFuncs(Pxa255uart* uart, Pxa255UartReadF readF, Pxa255UartWrite
 	uart->accessFuncsData = userData;
 }
 
+void pxa255uartSetSched(Pxa255uart* uart, Sched* sched, UInt32 period){
+	
+	uart->sched = sched;
+	uart->period = period;
+	schedEventInit(&uart->evt, pxa255uartPrvEvt, uart);
+	pxa255uartPrvKick(uart);
+}
+
+void pxa255uartRxReady(Pxa255uart* uart){
+	
+	pxa255uartPrvKick(uart);
+}
+
+void pxa255uartSetFastTx(Pxa255uart* uart, Boolean fast){
+	
+	uart->fastTx = fast;
+}
+
 Boolean pxa255uartInit(Pxa255uart* uart, ArmMem* physMem, Pxa255ic* ic, UInt32 baseAddr, UInt8 irq){
 	
 	__mem_zero(uart, sizeof(Pxa255uart));
@@ -429,6 +471,28 @@ Boolean pxa255uartInit(Pxa255uart* uart, ArmMem* physMem, Pxa255ic* ic, UInt32 b
 	return memRegionAdd(physMem, baseAddr, PXA255_UART_SIZE, pxa255uartPrvMemAccessF, uart);
 }
 
+void pxa255uartSnap(Pxa255uart* uart, Snap* s){
+	
+	snapVal(s, uart->TX);
+	snapVal(s, uart->RX);
+	snapVal(s, uart->transmitShift);
+	snapVal(s, uart->transmitHolding);
+	snapVal(s, uart->receiveHolding);
+	uart->cyclesSinceRecv = snapU32(s, uart->cyclesSinceRecv);
+	snapVal(s, uart->IER);
+	snapVal(s, uart->IIR);
+	snapVal(s, uart->FCR);
+	snapVal(s, uart->LCR);
+	snapVal(s, uart->LSR);
+	snapVal(s, uart->MCR);
+	snapVal(s, uart->MSR);
+	snapVal(s, uart->SPR);
+	snapVal(s, uart->DLL);
+	snapVal(s, uart->DLH);
+	snapVal(s, uart->ISR);
+	if(uart->sched) schedSnapEvent(uart->sched, &uart->evt, s);
+}
+
 void pxa255uartProcess(Pxa255uart* uart){		//send and rceive up to one character
 	
 	UInt8 t;
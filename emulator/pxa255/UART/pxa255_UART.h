@@ -4,6 +4,7 @@
 #include "../../memory/mem.h"
 #include "../../CPU/CPU.h"
 #include "../IC/pxa255_IC.h"
+#include "../../sched/sched.h"
 
 
 /*
@@ -15,6 +16,13 @@
 
 	by default we read nothing and write nowhere (buffer drains fast into nothingness)
 	this can be changed by addidng appropriate callbacks
+	
+	given a scheduler, the uart posts its own processing every "period" instrs, but only while it has something to
+	do: sending, or counting towards a receive timeout. whoever feeds readF calls pxa255uartRxReady() when there is
+	something to read, the uart does not poll for it
+	
+	in fast tx mode a char written to THR goes straight out to writeF, the transmitter is always empty and always
+	wants more. no real uart does that, but it lets the guest print as fast as it can write
 
 */
 
@@ -49,6 +57,10 @@ typedef struct{
 	Pxa255ic* ic;
 	UInt32 baseAddr;
 	
+	Sched* sched;
+	SchedEvent evt;
+	UInt32 period;
+	
 	Pxa255UartReadF readF;
 	Pxa255UartWriteF writeF;
 	void* accessFuncsData;
@@ -62,6 +74,7 @@ typedef struct{
 	
 	UInt8 irq:5;
 	UInt8 cyclesSinceRecv:3;
+	Boolean fastTx;
 	
 	UInt8 IER;		//interrupt enable register
 	UInt8 IIR;		//interrupt information register
@@ -83,6 +96,10 @@ Boolean pxa255uartInit(Pxa255uart* uart, ArmMem* physMem, Pxa255ic* ic, UInt32 b
 void pxa255uartProcess(Pxa255uart* uart);		//write out data in TX fifo and read data into RX fifo
 
 void pxa255uartSetFuncs(Pxa255uart* uart, Pxa255UartReadF readF, Pxa255UartWriteF writeF, void* userData);
+void pxa255uartSetSched(Pxa255uart* uart, Sched* sched, UInt32 period);
+void pxa255uartRxReady(Pxa255uart* uart);		//readF has data now
+void pxa255uartSetFastTx(Pxa255uart* uart, Boolean fast);
+void pxa255uartSnap(Pxa255uart* uart, Snap* s);		//registers and fifos only, the funcs, irq and sched setup come from whoever restores
 
 #endif
 
@@ -0,0 +1,124 @@
+#include "sched.h"
+
+
+static _INLINE_ void schedPrvPlace(Sched* s, SchedEvent* ev, UInt8 idx){
+	
+	s->heap[idx] = ev;
+	ev->idx = idx;
+}
+
+static void schedPrvSiftUp(Sched* s, UInt8 idx){
+	
+	SchedEvent* ev = s->heap[idx];
+	UInt8 parent;
+	
+	while(idx){
+		
+		parent = (idx - 1) / 2;
+		if(s->heap[parent]->when <= ev->when) break;
+		
+		schedPrvPlace(s, s->heap[parent], idx);
+		idx = parent;
+	}
+	schedPrvPlace(s, ev, idx);
+}
+
+static void schedPrvSiftDown(Sched* s, UInt8 idx){
+	
+	SchedEvent* ev = s->heap[idx];
+	UInt8 child;
+	
+	while((child = idx * 2 + 1) < s->num){
+		
+		if(child + 1 < s->num && s->heap[child + 1]->when < s->heap[child]->when) child++;
+		if(ev->when <= s->heap[child]->when) break;
+		
+		schedPrvPlace(s, s->heap[child], idx);
+		idx = child;
+	}
+	schedPrvPlace(s, ev, idx);
+}
+
+static void schedPrvRemove(Sched* s, SchedEvent* ev){
+	
+	SchedEvent* moved;
+	UInt8 idx = ev->idx;
+	
+	ev->idx = SCHED_NOT_POSTED;
+	if(idx == --s->num) return;
+	
+	moved = s->heap[s->num];		//the last one fills the hole, then goes wherever it belongs
+	schedPrvPlace(s, moved, idx);
+	schedPrvSiftUp(s, idx);
+	schedPrvSiftDown(s, moved->idx);
+}
+
+void schedInit(Sched* s, SchedKickF kickF, SchedElapsedF elapsedF, void* userData){
+	
+	s->now = 0;
+	s->num = 0;
+	s->kickF = kickF;
+	s->elapsedF = elapsedF;
+	s->userData = userData;
+}
+
+void schedEventInit(SchedEvent* ev, SchedEventF f, void* userData){
+	
+	ev->when = SCHED_NEVER;
+	ev->f = f;
+	ev->userData = userData;
+	ev->idx = SCHED_NOT_POSTED;
+}
+
+void schedAt(Sched* s, SchedEvent* ev, UInt64 when){
+	
+	UInt64 prevNext = schedNext(s);
+	
+	if(schedIsPosted(ev)) schedPrvRemove(s, ev);
+	
+	if(s->num == SCHED_MAX_EVENTS){
+		
+		err_str("Too many scheduled events, halting\r\n");
+		while(1);
+	}
+	
+	ev->when = when;
+	schedPrvPlace(s, ev, s->num++);
+	schedPrvSiftUp(s, ev->idx);
+	
+	if(when < prevNext && s->kickF) s->kickF(s->userData);
+}
+
+void schedCancel(Sched* s, SchedEvent* ev){
+	
+	if(schedIsPosted(ev)) schedPrvRemove(s, ev);
+}
+
+void schedRunDue(Sched* s){
+	
+	SchedEvent* ev;
+	
+	while(s->num && s->heap[0]->when <= s->now){
+		
+		ev = s->heap[0];
+		schedPrvRemove(s, ev);
+		ev->f(ev->userData);		//free to post itself again
+	}
+}
+
+void schedSnap(Sched* s, Snap* snap){
+	
+	snapVal(snap, s->now);
+}
+
+void schedSnapEvent(Sched* s, SchedEvent* ev, Snap* snap){
+	
+	UInt64 when = schedIsPosted(ev) ? ev->when : SCHED_NEVER;
+	
+	snapVal(snap, when);
+	
+	if(!snap->load) return;
+	
+	schedCancel(s, ev);
+	if(when != SCHED_NEVER) schedAt(s, ev, when);
+}
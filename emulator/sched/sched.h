@@ -0,0 +1,71 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+
+#include "../helper/types.h"
+#include "../math/math64.h"
+#include "../helper/snap.h"
+
+/*
+	device event scheduler. time is counted in instrs executed and never wraps. devices post "call me at time T"
+	and the cpu runs uninterrupted till the earliest such deadline. events are kept in a binary min-heap, each
+	event remembers where in the heap it is so it can be moved or cancelled without a search. s->now only moves
+	between runs, devices accessed mid-run use schedTime() which adds what the cpu has done since
+*/
+
+#define SCHED_MAX_EVENTS	32
+#define SCHED_NEVER		0xFFFFFFFFFFFFFFFFULL
+#define SCHED_NOT_POSTED	0xFF
+
+typedef void (*SchedEventF)(void* userData);
+typedef void (*SchedKickF)(void* userData);		//the earliest deadline just moved closer
+typedef UInt32 (*SchedElapsedF)(void* userData);	//instrs run since s->now was last advanced
+
+typedef struct{
+	
+	UInt64 when;
+	SchedEventF f;
+	void* userData;
+	UInt8 idx;		//position in the heap, SCHED_NOT_POSTED if not in it
+	
+}SchedEvent;
+
+typedef struct{
+	
+	UInt64 now;
+	SchedEvent* heap[SCHED_MAX_EVENTS];
+	UInt8 num;
+	
+	SchedKickF kickF;
+	SchedElapsedF elapsedF;
+	void* userData;
+	
+}Sched;
+
+
+void schedInit(Sched* s, SchedKickF kickF, SchedElapsedF elapsedF, void* userData);	//either may be NULL
+void schedEventInit(SchedEvent* ev, SchedEventF f, void* userData);
+
+void schedAt(Sched* s, SchedEvent* ev, UInt64 when);		//posts ev, or moves it if already posted
+void schedCancel(Sched* s, SchedEvent* ev);			//fine to call on events that are not posted
+void schedRunDue(Sched* s);					//calls everything due by s->now, in deadline order
+void schedSnap(Sched* s, Snap* snap);				//just the time, each owner snaps its own events
+void schedSnapEvent(Sched* s, SchedEvent* ev, Snap* snap);	//whether and when ev is posted
+
+static _INLINE_ UInt64 schedNext(Sched* s){			//SCHED_NEVER if nothing is posted
+	
+	return s->num ? s->heap[0]->when : SCHED_NEVER;
+}
+
+static _INLINE_ UInt64 schedTime(Sched* s){
+	
+	return s->elapsedF ? s->now + s->elapsedF(s->userData) : s->now;
+}
+
+static _INLINE_ Boolean schedIsPosted(SchedEvent* ev){
+	
+	return ev->idx != SCHED_NOT_POSTED;
+}
+
+
+#endif
@@ -12,8 +12,13 @@
 #include <linux/reboot.h>
 #include <linux/notifier.h>
 #include <linux/fb.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/slab.h>
 #include <asm/page.h>
 #include <asm/page.h>
+#include <asm/io.h>
+#include <mach/irqs.h>
 #include "types.h"
 
 
@@ -33,12 +38,34 @@
 
 	static unsigned long g_numSec, g_secSz;
 
+	#define PVD_MAX_SEGS		128	//emulator's BLK_MAX_SEGS
+	#define PVD_IO_SZ		4096	//what we ask the block layer to size and align requests to
+
+	struct pvd_seg{
+		u32 pa;
+		u32 len;
+	};
+	static struct pvd_seg* g_segs;			//only touched by our thread. kmalloc()ed: module data is not in the linear map, virt_to_phys() is wrong for it
+
+	#define PVD_IRQ			PXA_IRQ(15)	//reserved on a real PXA255, the emulator raises it when a request is done
+
+	static DECLARE_COMPLETION(g_done);		//irq handler -> our thread
+	static unsigned long g_doneSecs;
+
 
 #define PVD_INFO_NUM_SECTORS		0
 #define PVD_INFO_SECTOR_SZ		1
 
 #define CALL_SETUP			4
 #define CALL_ACCESS			5
+#define CALL_READ_DIRECT		6
+#define CALL_WRITE_DIRECT		7
+#define CALL_READ_SEGS			8
+#define CALL_WRITE_SEGS			9
+#define CALL_READ_ASYNC			10
+#define CALL_WRITE_ASYNC		11
+#define CALL_ACK			12
+#define CALL_FLUSH_ASYNC		13
 
 #define SETUP_OP_INFO			0
 #define SETUP_OP_READ			1
@@ -57,26 +84,28 @@ static int _sys_pvd_getinfo(int infoType, unsigned long* infoVal){
 	return 0;
 }
 
-static int _sys_pvd_read_sec(unsigned long sec, void* buf){
+static int _sys_pvd_segs(unsigned long sec, unsigned long num, unsigned long nsegs, int write){	//emulator moves g_segs[0..nsegs) straight to/from our memory
 	
-	int i;
-	unsigned long *p = buf;
+	if(!_sys_pvd_call(virt_to_phys(g_segs), sec, nsegs, write ? CALL_WRITE_ASYNC : CALL_READ_ASYNC)) return -EIO;
+	wait_for_completion(&g_done);		//we sleep, the rest of the system gets to run while the host does the I/O
 
-	_sys_pvd_call(SETUP_OP_READ, sec, 0, CALL_SETUP);
-	for(i = 0; i < g_secSz / sizeof(unsigned long); i++) *p++ = _sys_pvd_call(0, i, ACCESS_OP_READ, CALL_ACCESS);
+	return g_doneSecs == num ? 0 : -EIO;
+}
 
-	return 0;
+static int _sys_pvd_flush(void){	//everything written so far gets to stable storage on the host
+
+	if(!_sys_pvd_call(0, 0, 0, CALL_FLUSH_ASYNC)) return -EIO;
+	wait_for_completion(&g_done);
+
+	return g_doneSecs ? 0 : -EIO;
 }
 
-static int _sys_pvd_write_sec(unsigned long sec, const void* buf){
-	
-	int i;
-	const unsigned long *p = buf;
+static irqreturn_t pvd_irq(int irq, void* unused){
 
-	for(i = 0; i < g_secSz / sizeof(unsigned long); i++) _sys_pvd_call(*p++, i, ACCESS_OP_WRITE, CALL_ACCESS);
-	_sys_pvd_call(SETUP_OP_WRITE, sec, 0, CALL_SETUP);
+	g_doneSecs = _sys_pvd_call(0, 0, 0, CALL_ACK);	//also lowers the irq
+	complete(&g_done);
 
-	return 0;
+	return IRQ_HANDLED;
 }
 
 static unsigned long pvd_scale(unsigned long val_, unsigned long scale_factor){
@@ -88,38 +117,36 @@ static unsigned long pvd_scale(unsigned long val_, unsigned long scale_factor){
 	return val;
 }
 
-static int pvd_io(char* buf, unsigned long sec, unsigned long num, int op){
-	unsigned long sec_sz = g_secSz, num_sec = g_numSec, i;
-	int ret = 0;
+static int pvd_io(struct request* req, int write){	//the whole request, all its segments, as one call
+	unsigned long sec_sz = g_secSz, num_sec = g_numSec, sec, num, nsegs = 0;
+	struct req_iterator iter;
+	struct bio_vec* bvec;
+	u32 pa;
 
-	sec = pvd_scale(sec, sec_sz);
-	num = pvd_scale(num, sec_sz);
+	sec = pvd_scale(blk_rq_pos(req), sec_sz);
+	num = pvd_scale(blk_rq_sectors(req), sec_sz);
 
-	for(i = 0; i < num && !ret; i++, sec++, buf += sec_sz){
-		if(sec >= num_sec){
-			ret = -EIO;
-			break;
-		}
+	if(sec >= num_sec || num > num_sec - sec) return -EIO;
 
-		if(op == 1){
-			ret = _sys_pvd_write_sec(sec, buf);
-		}
-		else if(op == 0){
-			ret = _sys_pvd_read_sec(sec, buf);
-		}
-		else{
-			return -ENOTSUPP;
+	rq_for_each_segment(bvec, req, iter){
+		pa = page_to_phys(bvec->bv_page) + bvec->bv_offset;
+		if(nsegs && g_segs[nsegs - 1].pa + g_segs[nsegs - 1].len == pa){	//physically follows the last one
+			g_segs[nsegs - 1].len += bvec->bv_len;
+			continue;
 		}
+		if(nsegs == PVD_MAX_SEGS) return -EIO;		//queue limits should never let this happen
+		g_segs[nsegs].pa = pa;
+		g_segs[nsegs].len = bvec->bv_len;
+		nsegs++;
 	}
 
-	return ret;
+	return _sys_pvd_segs(sec, num, nsegs, write);
 }
 
 static int pvd_thread(void* unused){
 
 	struct request_queue *q = g_disk->queue;
 	struct request *req = NULL;
-	char* buf;
 	unsigned long sec, num;
 	int ret;
 
@@ -141,23 +168,26 @@ static int pvd_thread(void* unused){
 
 		if (blk_fs_request(req)) {
 
-			buf = req->buffer;
 			sec = blk_rq_pos(req);
-			num = blk_rq_cur_sectors(req);
+			num = blk_rq_sectors(req);
 			switch(rq_data_dir(req)){
 				case READ:
-					ret = pvd_io(buf, sec, num, 0);
+					ret = pvd_io(req, 0);
 					rq_flush_dcache_pages(req);
 					break;
 				case WRITE:
 					rq_flush_dcache_pages(req);
-					ret = pvd_io(buf, sec, num, 1);
+					ret = pvd_io(req, 1);
 					break;
 				default:
 					ret = -EIO;
 					break;
 			}
 		}
+		else if(req->cmd_type == REQ_TYPE_LINUX_BLOCK && req->cmd[0] == REQ_LB_OP_FLUSH){
+			sec = num = 0;
+			ret = _sys_pvd_flush();
+		}
 		else{
 			sec = num = -1;
 			ret = -EIO;
@@ -165,7 +195,8 @@ static int pvd_thread(void* unused){
 
 		spin_lock_irq(q->queue_lock);
 		nDEBUG("FTL DBG: ending request for %ld+%ld: %d\n", sec, num, ret);
-		if(!__blk_end_request_cur(req, ret)) req = NULL;
+		__blk_end_request_all(req, ret);
+		req = NULL;
 		nDEBUG("FTL DBG: done with request %s of %ld+%ld\n", sec, num);
 	}
 
@@ -176,6 +207,12 @@ static int pvd_thread(void* unused){
 	return 0;
 }
 
+static void pvd_prepare_flush(struct request_queue *q, struct request *req){	//barriers become a flush request for our thread
+
+	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
+	req->cmd[0] = REQ_LB_OP_FLUSH;
+}
+
 static void pvd_request(struct request_queue *q){
 
 	wake_up_process(g_thread);
@@ -254,19 +291,41 @@ static int __init pvd_init(void){
 	g_disk->flags = 0;
 
 	blk_queue_logical_block_size(queue, sec_sz);
+	blk_queue_physical_block_size(queue, PVD_IO_SZ);
+	blk_queue_io_min(queue, PVD_IO_SZ);
+	blk_queue_max_segments(queue, PVD_MAX_SEGS);
+	blk_queue_max_hw_sectors(queue, PVD_MAX_SEGS * (PAGE_SIZE >> 9));
+	blk_queue_ordered(queue, QUEUE_ORDERED_DRAIN_FLUSH, pvd_prepare_flush);	//host holds writes back, so the fs needs to be able to ask for them to be made durable
 	set_capacity(g_disk, (((loff_t)num_sec) * ((loff_t)sec_sz)) >> 9);
 
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, queue);	//we're not a rotary medium - do not waste time reordering requests
 	
+	ret = request_irq(PVD_IRQ, pvd_irq, IRQF_DISABLED, DRIVER_NAME, NULL);
+	if(ret){
+		nERROR("PVD: failed to get irq %d: %d\n", PVD_IRQ, ret);
+		goto out4;
+	}
+
+	g_segs = kmalloc(PVD_MAX_SEGS * sizeof(*g_segs), GFP_KERNEL);
+	if(!g_segs){
+		nERROR("PVD: failed to allocate the segment list\n");
+		ret = -ENOMEM;
+		goto out5;
+	}
+
 	g_thread = kthread_run(pvd_thread, NULL, "[pvd_worker]");
 	if(IS_ERR(g_thread)){
 		ret = PTR_ERR(g_thread);
-		goto out4;
+		goto out6;
 	}
 
 	add_disk(g_disk);
 
 	return 0;
+out6:
+	kfree(g_segs);
+out5:
+	free_irq(PVD_IRQ, NULL);
 out4:
 out3:
 	del_gendisk(g_disk);
@@ -283,6 +342,8 @@ static void __exit pvd_exit(void){
 
 	
 	kthread_stop(g_thread);
+	kfree(g_segs);
+	free_irq(PVD_IRQ, NULL);
 
 	del_gendisk(g_disk);
 	put_disk(g_disk);